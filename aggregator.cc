@@ -0,0 +1,136 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sstream>
+
+#include "aggregator.h"
+#include "stat_file.h"
+#include "stat_gen.h"
+#include "logging.h"
+#include "errors.h"
+
+Aggregator::Aggregator():
+  elapsed_usec_(0), processes_(0)
+{
+}
+
+void Aggregator::Merge(const vector<StatReport> &reports, uint64_t elapsed_usec)
+{
+  for (auto& report: reports) {
+    StatReport *target = NULL;
+    for (auto& existing: reports_) {
+      if (existing.get_url() == report.get_url()) {
+        target = &existing;
+        break;
+      }
+    }
+    if (target == NULL) {
+      reports_.push_back(report);
+    }
+    else {
+      target->Merge(report);
+    }
+  }
+  elapsed_usec_ = std::max(elapsed_usec_, elapsed_usec);
+  processes_++;
+}
+
+int Aggregator::AddFile(const string &path)
+{
+  vector<StatReport> reports;
+  uint64_t elapsed_usec;
+  if (StatFile::Load(path, &reports, &elapsed_usec) != RET_OK) {
+    return RET_FAIL;
+  }
+  Merge(reports, elapsed_usec);
+  return RET_OK;
+}
+
+int Aggregator::Collect(const string &socket_path, int processes)
+{
+  struct sockaddr_un addr;
+  if (socket_path.size() >= sizeof(addr.sun_path)) {
+    log_error("socket path '%s' is too long", socket_path.c_str());
+    return RET_FAIL;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_path.c_str());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    log_error("socket failed: %s", strerror(errno));
+    return RET_FAIL;
+  }
+  unlink(socket_path.c_str());
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, processes) != 0) {
+    log_error("failed to listen on '%s': %s", socket_path.c_str(),
+              strerror(errno));
+    close(fd);
+    return RET_FAIL;
+  }
+  log_info("waiting for %d processes on %s", processes, socket_path.c_str());
+
+  // Ctrl-C interrupts accept, the socket file is removed below
+  StatGenerator::HandleCntrlC();
+  int ret = RET_OK;
+  for (int i = 0; i < processes && !StatGenerator::IsExiting(); i++) {
+    int conn = accept(fd, NULL, NULL);
+    if (conn < 0) {
+      if (errno == EINTR) {
+        i--;
+        continue;
+      }
+      log_error("accept failed: %s", strerror(errno));
+      ret = RET_FAIL;
+      break;
+    }
+    // a sender writes its whole report and closes the connection
+    string data;
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(conn, buf, sizeof(buf))) != 0) {
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        log_error("read failed: %s", strerror(errno));
+        break;
+      }
+      data.append(buf, n);
+    }
+    close(conn);
+
+    std::istringstream is(data);
+    vector<StatReport> reports;
+    uint64_t elapsed_usec;
+    if (n < 0 || StatFile::Read(is, &reports, &elapsed_usec) != RET_OK) {
+      log_error("dropping malformed report of process %d", i + 1);
+      continue;
+    }
+    Merge(reports, elapsed_usec);
+    log_info("received report %d of %d", i + 1, processes);
+  }
+  close(fd);
+  unlink(socket_path.c_str());
+  return ret;
+}
+
+void Aggregator::Dump() const
+{
+  StatReport total;
+  for (auto& report: reports_) {
+    total.Merge(report);
+  }
+  double sec = elapsed_usec_ / 1000000.0;
+  log_println("aggregated %d processes, %ld requests in %.2f sec, %.2f MB/s",
+              processes_, total.get_requests(), sec,
+              sec > 0 ? total.get_bytes() / 1048576.0 / sec : 0);
+  total.DumpTotals();
+  for (auto& report: reports_) {
+    report.Dump();
+  }
+}
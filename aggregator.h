@@ -0,0 +1,35 @@
+#ifndef _AGGREGATOR_H_
+#define _AGGREGATOR_H_
+
+#include <string>
+#include <vector>
+
+#include "stat_report.h"
+
+using std::string;
+using std::vector;
+
+// Merges the saved or sent reports of several cloud-ping processes,
+// target by target, into one report. The processes are assumed to run
+// at the same time, the combined elapsed time is the longest one.
+class Aggregator
+{
+public:
+  Aggregator();
+  int AddFile(const string &path);
+  // accepts 'processes' connections on a unix socket, one report each
+  int Collect(const string &socket_path, int processes);
+  void Dump() const;
+
+  const vector<StatReport>& get_reports() const { return reports_; }
+  uint64_t get_elapsed_usec() const { return elapsed_usec_; }
+
+private:
+  void Merge(const vector<StatReport> &reports, uint64_t elapsed_usec);
+
+  vector<StatReport> reports_;
+  uint64_t elapsed_usec_;
+  int processes_;
+};
+
+#endif /* _AGGREGATOR_H_ */
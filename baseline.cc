@@ -0,0 +1,90 @@
+#include "baseline.h"
+#include "stat_file.h"
+#include "stat_math.h"
+#include "logging.h"
+#include "errors.h"
+
+static const double BASELINE_PERCENTILES[] = {50, 90, 99};
+
+Baseline::Baseline(double threshold_percent, double alpha):
+  threshold_percent_(threshold_percent), alpha_(alpha)
+{
+}
+
+int Baseline::Load(const string &path)
+{
+  uint64_t elapsed_usec;
+  return StatFile::Load(path, &reports_, &elapsed_usec);
+}
+
+static double DeltaPercent(double base, double current)
+{
+  return base > 0 ? (current - base) * 100 / base : 0;
+}
+
+bool Baseline::CompareReport(const StatReport &base, const StatReport &current) const
+{
+  bool regressed = false;
+  log_println("\n%s", current.get_url().c_str());
+  log_println("%-12s %12s %12s %9s", "", "baseline", "current", "delta");
+
+  // a latency regression needs both a large enough shift of a percentile
+  // and a significant shift of the whole distribution
+  vector<double> base_msecs;
+  vector<double> current_msecs;
+  base.GetSuccessMsecs(&base_msecs);
+  current.GetSuccessMsecs(&current_msecs);
+  double p_value = MannWhitneyGreater(base_msecs, current_msecs);
+  bool significant = p_value < alpha_;
+
+  for (auto percent: BASELINE_PERCENTILES) {
+    double base_msec = base.get_time_usec().Percentile(percent) / 1000.0;
+    double current_msec = current.get_time_usec().Percentile(percent) / 1000.0;
+    double delta = DeltaPercent(base_msec, current_msec);
+    bool worse = significant && delta > threshold_percent_;
+    log_println("p%-11.0f %9.2f ms %9.2f ms %+8.1f%%%s", percent, base_msec,
+                current_msec, delta, worse ? " REGRESSION" : "");
+    regressed |= worse;
+  }
+
+  // per request speed, the run's wall time is mostly the -i sleep
+  double base_mbsec = base.get_speed_bps().Percentile(50) / 1048576.0;
+  double current_mbsec = current.get_speed_bps().Percentile(50) / 1048576.0;
+  double delta = DeltaPercent(base_mbsec, current_mbsec);
+  bool worse = -delta > threshold_percent_;
+  log_println("%-12s %7.2f MB/s %7.2f MB/s %+8.1f%%%s", "throughput",
+              base_mbsec, current_mbsec, delta, worse ? " REGRESSION" : "");
+  regressed |= worse;
+
+  if (base_msecs.empty() || current_msecs.empty()) {
+    log_println("mann-whitney: no retained samples");
+  }
+  else {
+    log_println("mann-whitney: p=%.4f that latency got worse (%ld vs %ld samples)",
+                p_value, base_msecs.size(), current_msecs.size());
+  }
+  return regressed;
+}
+
+bool Baseline::Compare(const vector<StatReport> &reports) const
+{
+  bool regressed = false;
+  log_println("\nbaseline comparison (threshold %.1f%%, alpha %.3f)",
+              threshold_percent_, alpha_);
+  for (auto& current: reports) {
+    const StatReport *base = NULL;
+    for (auto& report: reports_) {
+      if (report.get_url() == current.get_url()) {
+        base = &report;
+        break;
+      }
+    }
+    if (base == NULL) {
+      log_println("\n%s: not in the baseline", current.get_url().c_str());
+      continue;
+    }
+    regressed |= CompareReport(*base, current);
+  }
+  log_println("\n%s", regressed ? "regression detected" : "no regression");
+  return regressed;
+}
@@ -0,0 +1,30 @@
+#ifndef _BASELINE_H_
+#define _BASELINE_H_
+
+#include <string>
+#include <vector>
+
+#include "stat_report.h"
+
+using std::string;
+using std::vector;
+
+// Compares the reports of a run against the ones saved by an earlier run
+// with --save-baseline, target by target.
+class Baseline
+{
+public:
+  Baseline(double threshold_percent, double alpha);
+  int Load(const string &path);
+  // returns true if any target regressed
+  bool Compare(const vector<StatReport> &reports) const;
+
+private:
+  bool CompareReport(const StatReport &base, const StatReport &current) const;
+
+  double threshold_percent_;
+  double alpha_;
+  vector<StatReport> reports_;
+};
+
+#endif /* _BASELINE_H_ */
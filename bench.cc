@@ -0,0 +1,351 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http_req.h"
+#include "s3_conn.h"
+#include "stat_gen.h"
+#include "logging.h"
+#include "errors.h"
+
+using std::string;
+using std::vector;
+
+// Micro benchmarks of the client hot paths and loopback benchmarks of
+// whole requests, run with 'make bench'. Every benchmark is calibrated to
+// take about BENCH_RUN_NSEC per run and repeated; the output is one line
+// per benchmark in a fixed order and format so the results of two commits
+// can be diffed.
+
+static const int BENCH_DEFAULT_RUNS = 10;
+static const uint64_t BENCH_RUN_NSEC = 50000000;
+static const uint64_t BENCH_MAX_OPS = 1ULL << 30;
+
+// runs the operation n times, returns the number of failed operations
+typedef std::function<uint64_t(uint64_t n)> BenchFn;
+
+static uint64_t NowNsec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void Usage()
+{
+  printf("Usage: cloud-ping-bench [-r runs] [filter]\n"
+         "Runs the benchmarks whose name contains 'filter', %d runs each by default.\n",
+         BENCH_DEFAULT_RUNS);
+  exit(1);
+}
+
+class BenchRunner
+{
+public:
+  // results go to 'out', the benchmarks may redirect stdout
+  BenchRunner(FILE *out, int runs, const string &filter):
+    out_(out), runs_(runs), filter_(filter) {}
+  void PrintHeader() const;
+  void Run(const string &name, BenchFn fn);
+
+private:
+  FILE *out_;
+  int runs_;
+  string filter_;
+};
+
+void BenchRunner::PrintHeader() const
+{
+  fprintf(out_, "# cloud-ping bench, %d runs per benchmark, nsec per operation\n", runs_);
+  fprintf(out_, "%-28s %10s %11s %11s %9s %11s %11s %12s %8s\n", "benchmark", "ops/run",
+          "median", "mean", "stddev", "min", "max", "ops/sec", "failed");
+}
+
+void BenchRunner::Run(const string &name, BenchFn fn)
+{
+  if (name.find(filter_) == string::npos) {
+    return;
+  }
+
+  // the calibration runs double as warm-up
+  uint64_t ops = 1;
+  while (ops < BENCH_MAX_OPS) {
+    uint64_t start = NowNsec();
+    fn(ops);
+    uint64_t nsec = NowNsec() - start;
+    if (nsec >= BENCH_RUN_NSEC / 2) {
+      ops = std::max((uint64_t)1, (uint64_t)((double)ops * BENCH_RUN_NSEC / nsec));
+      break;
+    }
+    ops = nsec > 0 ? std::min(ops * 8, ops * BENCH_RUN_NSEC / nsec + 1) : ops * 8;
+  }
+
+  vector<double> per_op;
+  uint64_t failed = 0;
+  for (int i = 0; i < runs_; i++) {
+    uint64_t start = NowNsec();
+    failed += fn(ops);
+    per_op.push_back((double)(NowNsec() - start) / ops);
+  }
+
+  std::sort(per_op.begin(), per_op.end());
+  double mean = 0;
+  for (double v: per_op) {
+    mean += v;
+  }
+  mean /= per_op.size();
+  double var = 0;
+  for (double v: per_op) {
+    var += (v - mean) * (v - mean);
+  }
+  double stddev = per_op.size() > 1 ? sqrt(var / (per_op.size() - 1)) : 0;
+  size_t mid = per_op.size() / 2;
+  double median = per_op.size() % 2 == 1 ? per_op[mid] :
+    (per_op[mid - 1] + per_op[mid]) / 2;
+  fprintf(out_, "%-28s %10lu %11.1f %11.1f %9.1f %11.1f %11.1f %12.0f %8lu\n",
+          name.c_str(), ops, median, mean, stddev, per_op.front(), per_op.back(),
+          median > 0 ? 1e9 / median : 0, failed);
+  fflush(out_);
+}
+
+// HTTP/1.1 server on 127.0.0.1 answering every GET with body_size bytes,
+// a thread per connection, connections kept alive until the client closes
+class LoopbackServer
+{
+public:
+  LoopbackServer(): listen_fd_(-1), port_(0) {}
+  int Start(size_t body_size);
+  int get_port() const { return port_; }
+
+private:
+  void AcceptLoop();
+  void Serve(int fd);
+
+  int listen_fd_;
+  int port_;
+  string response_;
+};
+
+int LoopbackServer::Start(size_t body_size)
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+
+  response_ = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(body_size) +
+    "\r\n\r\n" + string(body_size, 'x');
+  listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    log_error("Failed to create socket errno=%d", errno);
+    return RET_FAIL;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(listen_fd_, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(listen_fd_, 128) != 0 ||
+      getsockname(listen_fd_, (struct sockaddr *)&addr, &len) != 0) {
+    log_error("Failed to listen on loopback errno=%d", errno);
+    close(listen_fd_);
+    return RET_FAIL;
+  }
+  port_ = ntohs(addr.sin_port);
+  std::thread(&LoopbackServer::AcceptLoop, this).detach();
+  return RET_OK;
+}
+
+void LoopbackServer::AcceptLoop()
+{
+  while (true) {
+    int fd = accept4(listen_fd_, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      return;
+    }
+    std::thread(&LoopbackServer::Serve, this, fd).detach();
+  }
+}
+
+void LoopbackServer::Serve(int fd)
+{
+  char buf[4096];
+  string pending;
+
+  while (true) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0) {
+      break;
+    }
+    pending.append(buf, n);
+    size_t end;
+    while ((end = pending.find("\r\n\r\n")) != string::npos) {
+      pending.erase(0, end + 4);
+      size_t sent = 0;
+      while (sent < response_.size()) {
+        ssize_t w = send(fd, response_.data() + sent, response_.size() - sent,
+                         MSG_NOSIGNAL);
+        if (w <= 0) {
+          close(fd);
+          return;
+        }
+        sent += w;
+      }
+    }
+  }
+  close(fd);
+}
+
+static void BenchMicro(BenchRunner *runner)
+{
+  runner->Run("s3.sign", [](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      S3Connection::Sign("bucket", "/dir/object.bin", "secret-key-0123456789",
+                         "Mon, 19 Oct 2026 10:00:00 GMT");
+    }
+    return (uint64_t)0;
+  });
+
+  runner->Run("http_req.range_header", [](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      HttpReq req;
+      req.AddGetRangeHeader(i, i + 1048576);
+    }
+    return (uint64_t)0;
+  });
+
+  // the events of a 64KB response arriving in 16 chunks
+  runner->Run("statistics.events", [](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      Statistics stat;
+      stat.OnReqStart();
+      stat.OnReqSendHeaders();
+      stat.OnReqRecvHeaders();
+      stat.OnReqRecvHeaders();
+      for (int chunk = 0; chunk < 16; chunk++) {
+        stat.OnReqRecvData(4096);
+      }
+      stat.OnComplete(200, REQ_OK);
+    }
+    return (uint64_t)0;
+  });
+
+  // filtered below the log level, and written to /dev/null at each level
+  runner->Run("log_write.filtered", [](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      log_debug("request %lu", i);
+    }
+    return (uint64_t)0;
+  });
+
+  static const char *level_names[] = {"error", "warning", "notice", "info", "debug"};
+  fflush(stdout);
+  int saved_stdout = dup(STDOUT_FILENO);
+  int null_fd = open("/dev/null", O_WRONLY);
+  for (int level = LOG_ERROR; level <= LOG_DEBUG; level++) {
+    string name = string("log_write.") + level_names[level];
+    log_set_level(LOG_DEBUG);
+    dup2(null_fd, STDOUT_FILENO);
+    runner->Run(name, [level](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++) {
+        log_write((LogLevel)level, __PRETTY_FUNCTION__, __LINE__,
+                  "request %lu\n", i);
+      }
+      fflush(stdout);
+      return (uint64_t)0;
+    });
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    log_set_level(LOG_ERROR);
+  }
+  close(null_fd);
+  close(saved_stdout);
+}
+
+static void BenchLoopback(BenchRunner *runner, HttpEngine engine, size_t body_size,
+                          bool keep_alive)
+{
+  // lives until exit, its connection threads are detached
+  LoopbackServer *server = new LoopbackServer();
+  if (server->Start(body_size) != RET_OK) {
+    delete server;
+    return;
+  }
+
+  string url = "http://127.0.0.1:" + std::to_string(server->get_port()) + "/object";
+  HttpReqOptions options;
+  options.engine = engine;
+  options.keep_alive = keep_alive;
+  string name = string("loopback.") + (engine == HTTP_ENGINE_RAW ? "raw." : "curl.") +
+    (body_size >= 1048576 ? std::to_string(body_size / 1048576) + "m" :
+     std::to_string(body_size / 1024) + "k") +
+    (keep_alive ? ".keepalive" : ".newconn");
+
+  runner->Run(name, [&](uint64_t n) {
+    uint64_t failed = 0;
+    for (uint64_t i = 0; i < n; i++) {
+      Statistics stat;
+      HttpReq req;
+      req.SetUrl(url);
+      req.SetOptions(options);
+      req.ReportEvents(&stat);
+      req.PerformGet();
+      if (!stat.IsSuccess() || stat.get_data_size() != body_size) {
+        failed++;
+      }
+    }
+    return failed;
+  });
+}
+
+int main(int argc, char *argv[])
+{
+  int runs = BENCH_DEFAULT_RUNS;
+  string filter;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "r:h")) != -1) {
+    if (opt == 'r' && atoi(optarg) > 0) {
+      runs = atoi(optarg);
+    }
+    else {
+      Usage();
+    }
+  }
+  if (optind < argc) {
+    filter = argv[optind];
+  }
+
+  log_set_level(LOG_ERROR);
+  if (HttpReq::Init() != RET_OK) {
+    return 1;
+  }
+  FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+  if (out == NULL) {
+    return 1;
+  }
+  BenchRunner runner(out, runs, filter);
+  runner.PrintHeader();
+  BenchMicro(&runner);
+  for (HttpEngine engine: {HTTP_ENGINE_CURL, HTTP_ENGINE_RAW}) {
+    BenchLoopback(&runner, engine, 1024, true);
+    BenchLoopback(&runner, engine, 1024, false);
+    BenchLoopback(&runner, engine, 1048576, true);
+  }
+  HttpReq::Fini();
+  fclose(out);
+  return 0;
+}
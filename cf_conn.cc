@@ -9,9 +9,9 @@
 #include "stat_gen.h"
 
 
-#define CANNED_POLICY "{\"Statement\":[{\"Resource\":\"http://%s\",\"Condition\":{\"DateLessThan\":{\"AWS:EpochTime\":%ld}}}]}"
+#define CANNED_POLICY "{\"Statement\":[{\"Resource\":\"%s%s\",\"Condition\":{\"DateLessThan\":{\"AWS:EpochTime\":%ld}}}]}"
 #define SIGN_POLICY "echo -n '%s' | openssl sha1 -sign %s | openssl base64 | tr '+=/' '-_~' | tr -d '\n'"
-#define SIGNED_URL "http://%s?Expires=%ld&Signature=%s&Key-Pair-Id=%s"
+#define SIGNED_URL "%s%s?Expires=%ld&Signature=%s&Key-Pair-Id=%s"
 
 static string Popen(const string& cmd)
 {
@@ -39,10 +39,10 @@ string CloudFrontConnection::BuildSignedUrl()
   expires += 60*60*24;
   expires = 1387605457;
 
-  string policy = str(boost::format(CANNED_POLICY) % url_ % expires);
+  string policy = str(boost::format(CANNED_POLICY) % scheme() % url_ % expires);
   string cmd = str(boost::format(SIGN_POLICY) % policy % priv_key_path);
   string encoded_policy = Popen(cmd);
-  return str(boost::format(SIGNED_URL) % url_ % expires % encoded_policy % key_pair_id);
+  return str(boost::format(SIGNED_URL) % scheme() % url_ % expires % encoded_policy % key_pair_id);
 }
 
 void CloudFrontConnection::PerformGet(Statistics *stat)
@@ -58,6 +58,7 @@ void CloudFrontConnection::PerformGet(Statistics *stat)
   req.SetUrl(signed_url);
   stat->set_url(url_);
   ApplyLimits(&req);
+  ApplyReqOptions(&req);
   req.ReportEvents(stat);
   req.PerformGet();
 
@@ -6,8 +6,8 @@
 class CloudFrontConnection : public CloudConnection
 {
 public:
-  CloudFrontConnection(const string &url, const string &auth):
-    CloudConnection(url, auth) {}
+  CloudFrontConnection(const string &url, const string &auth, bool secure):
+    CloudConnection(url, auth, secure) {}
   virtual void PerformGet(Statistics *stat);
 private:
   string BuildSignedUrl();
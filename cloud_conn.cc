@@ -6,8 +6,9 @@
 #include "cf_conn.h"
 
 
-CloudConnection::CloudConnection(const string &url, const string &auth):
-  url_(url), auth_(auth)
+CloudConnection::CloudConnection(const string &url, const string &auth,
+                                 bool secure):
+  url_(url), auth_(auth), secure_(secure)
 {
 }
 
@@ -20,6 +21,22 @@ void CloudConnection::SetLimits(uint64_t range_start,
   recv_limit_size_ = recv_limit_size;
 }
 
+void CloudConnection::SetRange(uint64_t range_start, uint64_t range_end)
+{
+  range_start_ = range_start;
+  range_end_ = range_end;
+}
+
+void CloudConnection::SetReqOptions(const HttpReqOptions &options)
+{
+  req_options_ = options;
+}
+
+void CloudConnection::ApplyReqOptions(HttpReq *req)
+{
+  req->SetOptions(req_options_);
+}
+
 void CloudConnection::ApplyLimits(HttpReq *req)
 {
   if (recv_limit_size_ > 0) {
@@ -38,14 +55,14 @@ CloudConnection *CloudConnectionFactory::NewConnection(const string &url,
   }
   auto protocol = url.substr(0, protocol_end);
   auto url_rest = url.substr(protocol_end+3);
-  if (protocol == "http") {
-    return new HttpConnection(url_rest, auth);
+  if (protocol == "http" || protocol == "https") {
+    return new HttpConnection(url_rest, auth, protocol == "https");
   }
-  else if (protocol == "s3") {
-    return new S3Connection(url_rest, auth);
+  else if (protocol == "s3" || protocol == "s3s") {
+    return new S3Connection(url_rest, auth, protocol == "s3s");
   }
-  else if (protocol == "cf") {
-    return new CloudFrontConnection(url_rest, auth);
+  else if (protocol == "cf" || protocol == "cfs") {
+    return new CloudFrontConnection(url_rest, auth, protocol == "cfs");
   }
   return nullptr;
 }
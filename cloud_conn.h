@@ -3,28 +3,36 @@
 
 #include <string>
 
+#include "http_req.h"
+
 using std::string;
 
 class Statistics;
-class HttpReq;
 
 class CloudConnection
 {
 public:
-  CloudConnection(const string &url, const string &auth);
+  CloudConnection(const string &url, const string &auth, bool secure);
   void SetLimits(uint64_t range_start,
                  uint64_t range_end,
                  size_t recv_limit_size);
+  void SetRange(uint64_t range_start, uint64_t range_end);
+  void SetReqOptions(const HttpReqOptions &options);
+  const string& get_url() const { return url_; }
 
   virtual void PerformGet(Statistics *stat) = 0;
 protected:
   void ApplyLimits(HttpReq *req);
+  void ApplyReqOptions(HttpReq *req);
+  const char *scheme() const { return secure_ ? "https://" : "http://"; }
 protected:
   string url_;
   string auth_;
+  bool secure_;
   uint64_t range_start_;
   uint64_t range_end_;
   uint64_t recv_limit_size_;
+  HttpReqOptions req_options_;
 };
 
 class CloudConnectionFactory
@@ -0,0 +1,86 @@
+#include <unistd.h>
+#include <stdlib.h>
+#include <vector>
+#include <string>
+
+#include "shm_metrics.h"
+#include "logging.h"
+#include "errors.h"
+
+using std::string;
+using std::vector;
+
+static void Usage()
+{
+  printf("Usage: cloud-ping-top NAME [interval-sec]\n"
+         "Shows the live rates and latency percentiles of a cloud-ping\n"
+         "started with --shm NAME.\n");
+  exit(1);
+}
+
+// requests between two snapshots, bucket by bucket
+static Histogram Delta(const Histogram &now, const Histogram &before)
+{
+  Histogram delta;
+  for (int i = 0; i < Histogram::kNumBuckets; i++) {
+    uint64_t n = now.bucket_count(i) - before.bucket_count(i);
+    if (n > 0) {
+      delta.Record(Histogram::BucketLow(i), n);
+    }
+  }
+  return delta;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2 || argc > 3) {
+    Usage();
+  }
+  double interval = argc == 3 ? atof(argv[2]) : 1;
+  if (interval <= 0) {
+    Usage();
+  }
+
+  ShmMetrics metrics;
+  if (metrics.Attach(argv[1]) != RET_OK) {
+    return 1;
+  }
+
+  vector<ShmMetrics::Snapshot> last(metrics.get_targets());
+  for (int i = 0; i < metrics.get_targets(); i++) {
+    metrics.Read(i, &last[i]);
+  }
+  bool running = true;
+  while (running) {
+    usleep(interval * 1000000);
+    running = metrics.IsRunning();
+
+    printf("\033[H\033[2J");
+    printf("cloud-ping pid %u %s, every %.1f sec\n\n", metrics.get_pid(),
+           running ? "running" : "finished", interval);
+    printf("%-40s %9s %7s %10s %10s %24s %24s\n", "target", "requests",
+           "failed", "req/s", "MB/s", "p50/p90/p99 ms", "total p50/p90/p99 ms");
+    for (int i = 0; i < metrics.get_targets(); i++) {
+      ShmMetrics::Snapshot now;
+      metrics.Read(i, &now);
+      Histogram delta = Delta(now.time_usec, last[i].time_usec);
+      uint64_t requests = now.requests - last[i].requests;
+      uint64_t bytes = now.bytes - last[i].bytes;
+      char window[64];
+      char total[64];
+      snprintf(window, sizeof(window), "%.2f/%.2f/%.2f",
+               delta.Percentile(50) / 1000.0, delta.Percentile(90) / 1000.0,
+               delta.Percentile(99) / 1000.0);
+      snprintf(total, sizeof(total), "%.2f/%.2f/%.2f",
+               now.time_usec.Percentile(50) / 1000.0,
+               now.time_usec.Percentile(90) / 1000.0,
+               now.time_usec.Percentile(99) / 1000.0);
+      printf("%-40.40s %9lu %7lu %10.2f %10.2f %24s %24s\n", metrics.get_url(i),
+             now.requests, now.requests - now.successes, requests / interval,
+             bytes / 1048576.0 / interval, window, total);
+      last[i] = now;
+    }
+    fflush(stdout);
+  }
+  return 0;
+}
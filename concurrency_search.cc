@@ -0,0 +1,103 @@
+#include <boost/format.hpp>
+
+#include "concurrency_search.h"
+#include "stat_gen.h"
+#include "logging.h"
+
+ConcurrencySearch::ConcurrencySearch(StatGenerator *gen, int max_concurrency,
+                                     int step, double slo_p99_msec,
+                                     double plateau_percent):
+  gen_(gen), max_concurrency_(max_concurrency), step_(step),
+  slo_p99_msec_(slo_p99_msec), plateau_percent_(plateau_percent), knee_(-1)
+{
+}
+
+ConcurrencySearch::Step ConcurrencySearch::RunStep(int concurrency, int count,
+                                                   int warmup)
+{
+  gen_->SetConcurrency(concurrency);
+  if (warmup > 0) {
+    gen_->RunTrial(warmup * concurrency, 0, false);
+  }
+  gen_->ResetReports();
+  // every worker runs 'count' rounds so the steps are equally precise
+  gen_->RunTrial(count * concurrency, 0, false);
+
+  StatReport total = gen_->GetTotalReport();
+  double sec = gen_->get_elapsed_usec() / 1000000.0;
+  Step step;
+  step.concurrency = concurrency;
+  step.requests = total.get_requests();
+  step.failures = total.get_requests() - total.get_successes();
+  step.mbsec = sec > 0 ? total.get_bytes() / 1048576.0 / sec : 0;
+  step.reqsec = sec > 0 ? total.get_requests() / sec : 0;
+  step.p50_msec = total.get_time_usec().Percentile(50) / 1000.0;
+  step.p90_msec = total.get_time_usec().Percentile(90) / 1000.0;
+  step.p99_msec = total.get_time_usec().Percentile(99) / 1000.0;
+  log_println("concurrency %d: %ld requests %.2f MB/s %.2f req/s p99 %.2f ms",
+              concurrency, step.requests, step.mbsec, step.reqsec,
+              step.p99_msec);
+  return step;
+}
+
+void ConcurrencySearch::Run(int count, int warmup)
+{
+  gen_->SetQuiet(true);
+  int concurrency = 1;
+  while (!StatGenerator::IsExiting() && concurrency <= max_concurrency_) {
+    Step step = RunStep(concurrency, count, warmup);
+    steps_.push_back(step);
+
+    if (slo_p99_msec_ > 0 && step.p99_msec > slo_p99_msec_) {
+      stop_reason_ = str(boost::format("p99 %.2f ms broke the %.2f ms SLO at concurrency %d") %
+                         step.p99_msec % slo_p99_msec_ % concurrency);
+      break;
+    }
+    if (step.failures > 0) {
+      stop_reason_ = str(boost::format("%d failed requests at concurrency %d") %
+                         step.failures % concurrency);
+      break;
+    }
+    if (knee_ >= 0) {
+      const Step &best = steps_[knee_];
+      if (step.mbsec < best.mbsec * (1 + plateau_percent_ / 100)) {
+        stop_reason_ = str(boost::format("throughput grew less than %.1f%% at concurrency %d") %
+                           plateau_percent_ % concurrency);
+        break;
+      }
+    }
+    knee_ = steps_.size() - 1;
+
+    concurrency = step_ > 0 ? concurrency + step_ : concurrency * 2;
+  }
+  if (stop_reason_.empty()) {
+    stop_reason_ = StatGenerator::IsExiting() ? "interrupted" :
+      str(boost::format("reached the maximum concurrency %d") % max_concurrency_);
+  }
+}
+
+void ConcurrencySearch::Dump() const
+{
+  log_println("\nconcurrency search (slo p99 %s, plateau below %.1f%% gain)",
+              slo_p99_msec_ > 0 ?
+              str(boost::format("<= %.2f ms") % slo_p99_msec_).c_str() : "none",
+              plateau_percent_);
+  log_println("  %11s %8s %8s %10s %10s %10s %10s %10s", "concurrency",
+              "requests", "failures", "MB/s", "req/s", "p50 ms", "p90 ms",
+              "p99 ms");
+  for (size_t i = 0; i < steps_.size(); i++) {
+    const Step &step = steps_[i];
+    log_println("%s %11d %8ld %8ld %10.2f %10.2f %10.2f %10.2f %10.2f",
+                (int)i == knee_ ? "*" : " ",
+                step.concurrency, step.requests, step.failures, step.mbsec,
+                step.reqsec, step.p50_msec, step.p90_msec, step.p99_msec);
+  }
+  if (knee_ < 0) {
+    log_println("  no knee found: %s", stop_reason_.c_str());
+    return;
+  }
+  const Step &knee = steps_[knee_];
+  log_println("  knee at concurrency %d: %.2f MB/s %.2f req/s p99 %.2f ms (%s)",
+              knee.concurrency, knee.mbsec, knee.reqsec, knee.p99_msec,
+              stop_reason_.c_str());
+}
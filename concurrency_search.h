@@ -0,0 +1,45 @@
+#ifndef _CONCURRENCY_SEARCH_H_
+#define _CONCURRENCY_SEARCH_H_
+
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+class StatGenerator;
+
+// Ramps the number of requests in flight until throughput stops growing
+// or the p99 latency breaks the SLO and reports the knee of the curve.
+class ConcurrencySearch
+{
+public:
+  ConcurrencySearch(StatGenerator *gen, int max_concurrency, int step,
+                    double slo_p99_msec, double plateau_percent);
+  void Run(int count, int warmup);
+  void Dump() const;
+
+private:
+  struct Step {
+    int concurrency;
+    uint64_t requests;
+    uint64_t failures;
+    double mbsec;
+    double reqsec;
+    double p50_msec;
+    double p90_msec;
+    double p99_msec;
+  };
+  Step RunStep(int concurrency, int count, int warmup);
+
+  StatGenerator *gen_;
+  int max_concurrency_;
+  int step_;
+  double slo_p99_msec_;
+  double plateau_percent_;
+  vector<Step> steps_;
+  int knee_;
+  string stop_reason_;
+};
+
+#endif /* _CONCURRENCY_SEARCH_H_ */
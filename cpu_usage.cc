@@ -0,0 +1,132 @@
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "cpu_usage.h"
+#include "logging.h"
+
+CpuCounters::CpuCounters():
+  user_usec(0), sys_usec(0), voluntary_switches(0), involuntary_switches(0),
+  minor_faults(0), major_faults(0), has_perf(false), cycles(0),
+  instructions(0)
+{
+}
+
+void CpuCounters::Add(const CpuCounters &other)
+{
+  user_usec += other.user_usec;
+  sys_usec += other.sys_usec;
+  voluntary_switches += other.voluntary_switches;
+  involuntary_switches += other.involuntary_switches;
+  minor_faults += other.minor_faults;
+  major_faults += other.major_faults;
+  has_perf = has_perf || other.has_perf;
+  cycles += other.cycles;
+  instructions += other.instructions;
+}
+
+void CpuCounters::Sub(const CpuCounters &other)
+{
+  user_usec -= other.user_usec;
+  sys_usec -= other.sys_usec;
+  voluntary_switches -= other.voluntary_switches;
+  involuntary_switches -= other.involuntary_switches;
+  minor_faults -= other.minor_faults;
+  major_faults -= other.major_faults;
+  cycles -= other.cycles;
+  instructions -= other.instructions;
+}
+
+static int PerfEventOpen(uint64_t config, int group_fd, bool exclude_kernel)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.exclude_kernel = exclude_kernel;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+    PERF_FORMAT_TOTAL_TIME_RUNNING;
+  // pid 0, cpu -1: the calling thread on any cpu
+  return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+CpuUsage::CpuUsage():
+  perf_fd_(-1), instructions_fd_(-1)
+{
+}
+
+CpuUsage::~CpuUsage()
+{
+  Stop();
+}
+
+void CpuUsage::Start()
+{
+  // kernel cycles need perf_event_paranoid < 2, fall back to user only
+  bool exclude_kernel = false;
+  perf_fd_ = PerfEventOpen(PERF_COUNT_HW_CPU_CYCLES, -1, exclude_kernel);
+  if (perf_fd_ < 0 && (errno == EACCES || errno == EPERM)) {
+    exclude_kernel = true;
+    perf_fd_ = PerfEventOpen(PERF_COUNT_HW_CPU_CYCLES, -1, exclude_kernel);
+  }
+  if (perf_fd_ >= 0) {
+    instructions_fd_ = PerfEventOpen(PERF_COUNT_HW_INSTRUCTIONS, perf_fd_,
+                                     exclude_kernel);
+    if (instructions_fd_ < 0) {
+      close(perf_fd_);
+      perf_fd_ = -1;
+    }
+  }
+  if (perf_fd_ < 0) {
+    log_info("perf counters unavailable: %s", strerror(errno));
+  }
+  ReadNow(&start_);
+}
+
+void CpuUsage::ReadNow(CpuCounters *counters) const
+{
+  struct rusage usage;
+  getrusage(RUSAGE_THREAD, &usage);
+  counters->user_usec = usage.ru_utime.tv_sec * 1000000ULL + usage.ru_utime.tv_usec;
+  counters->sys_usec = usage.ru_stime.tv_sec * 1000000ULL + usage.ru_stime.tv_usec;
+  counters->voluntary_switches = usage.ru_nvcsw;
+  counters->involuntary_switches = usage.ru_nivcsw;
+  counters->minor_faults = usage.ru_minflt;
+  counters->major_faults = usage.ru_majflt;
+
+  // nr, time enabled, time running, cycles, instructions
+  uint64_t values[5];
+  counters->has_perf = false;
+  if (perf_fd_ >= 0 && read(perf_fd_, values, sizeof(values)) == sizeof(values) &&
+      values[0] == 2) {
+    // scale up if the counters were multiplexed
+    double scale = values[2] > 0 ? (double)values[1] / values[2] : 1;
+    counters->has_perf = true;
+    counters->cycles = values[3] * scale;
+    counters->instructions = values[4] * scale;
+  }
+}
+
+void CpuUsage::Read(CpuCounters *counters) const
+{
+  ReadNow(counters);
+  counters->Sub(start_);
+}
+
+void CpuUsage::Stop()
+{
+  if (instructions_fd_ >= 0) {
+    close(instructions_fd_);
+    instructions_fd_ = -1;
+  }
+  if (perf_fd_ >= 0) {
+    close(perf_fd_);
+    perf_fd_ = -1;
+  }
+}
@@ -0,0 +1,47 @@
+#ifndef _CPU_USAGE_H_
+#define _CPU_USAGE_H_
+
+#include <stdint.h>
+
+// CPU spent by one thread: getrusage(RUSAGE_THREAD) and, when the kernel
+// allows it, cycles and instructions from perf_event_open
+struct CpuCounters
+{
+  CpuCounters();
+  void Add(const CpuCounters &other);
+  void Sub(const CpuCounters &other);
+  uint64_t cpu_usec() const { return user_usec + sys_usec; }
+
+  uint64_t user_usec;
+  uint64_t sys_usec;
+  uint64_t voluntary_switches;
+  uint64_t involuntary_switches;
+  uint64_t minor_faults;
+  uint64_t major_faults;
+  bool has_perf;
+  uint64_t cycles;
+  uint64_t instructions;
+};
+
+// Counts the CPU of the thread that calls Start(), Read() and Stop() must
+// be called by the same thread
+class CpuUsage
+{
+public:
+  CpuUsage();
+  ~CpuUsage();
+  void Start();
+  // counters since Start()
+  void Read(CpuCounters *counters) const;
+  void Stop();
+
+private:
+  void ReadNow(CpuCounters *counters) const;
+
+  // group leader counting cycles and its instructions member
+  int perf_fd_;
+  int instructions_fd_;
+  CpuCounters start_;
+};
+
+#endif /* _CPU_USAGE_H_ */
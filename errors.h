@@ -3,5 +3,6 @@
 
 #define RET_OK 0
 #define RET_FAIL 1
+#define RET_REGRESSION 2
 
 #endif /* _ERRORS_H_ */
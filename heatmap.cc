@@ -0,0 +1,247 @@
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <fstream>
+#include "logging.h"
+#include "errors.h"
+
+#include "heatmap.h"
+
+// terminal columns and rows of the rendering
+static const size_t HEATMAP_COLUMNS = 72;
+static const int HEATMAP_ROWS = 20;
+// from no requests to the busiest cell, on a log scale
+static const char HEATMAP_SHADES[] = " .:-=+*#%@";
+
+static void PutVarint(uint64_t value, vector<uint8_t> *out)
+{
+  while (value >= 0x80) {
+    out->push_back((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back((uint8_t)value);
+}
+
+static uint64_t GetVarint(const vector<uint8_t> &in, size_t *pos)
+{
+  uint64_t value = 0;
+  int shift = 0;
+  while (*pos < in.size()) {
+    uint8_t byte = in[(*pos)++];
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      break;
+    }
+    shift += 7;
+  }
+  return value;
+}
+
+Heatmap::Heatmap(uint64_t window_usec):
+  window_usec_(std::max(window_usec, (uint64_t)1)), started_(false),
+  current_idx_(0), current_empty_(true)
+{
+  memset(&start_, 0, sizeof(start_));
+  memset(current_, 0, sizeof(current_));
+}
+
+void Heatmap::Start()
+{
+  if (!started_) {
+    gettimeofday(&start_, NULL);
+    started_ = true;
+  }
+}
+
+/* static */
+uint64_t Heatmap::BucketLow(int idx)
+{
+  return Histogram::BucketLow(idx << kBucketShift);
+}
+
+/* static */
+uint64_t Heatmap::BucketHigh(int idx)
+{
+  int last = std::min((idx << kBucketShift) + (1 << kBucketShift) - 1,
+                      Histogram::kNumBuckets - 1);
+  return Histogram::BucketHigh(last);
+}
+
+/* static */
+void Heatmap::Encode(const uint64_t *counts, vector<uint8_t> *out)
+{
+  int prev = 0;
+  out->clear();
+  for (int i = 0; i < kNumBuckets; i++) {
+    if (counts[i] == 0) {
+      continue;
+    }
+    // (distance to the previous non empty bucket, count) pairs
+    PutVarint(i - prev, out);
+    PutVarint(counts[i], out);
+    prev = i;
+  }
+  out->shrink_to_fit();
+}
+
+/* static */
+void Heatmap::Decode(const vector<uint8_t> &in, uint64_t *counts)
+{
+  size_t pos = 0;
+  int idx = 0;
+  while (pos < in.size()) {
+    idx += GetVarint(in, &pos);
+    uint64_t count = GetVarint(in, &pos);
+    if (idx < kNumBuckets) {
+      counts[idx] += count;
+    }
+  }
+}
+
+void Heatmap::Add(const struct timeval &now, const Histogram &hist)
+{
+  if (hist.count() == 0) {
+    return;
+  }
+  Start();
+  int64_t usec = (now.tv_sec - start_.tv_sec) * 1000000LL + now.tv_usec - start_.tv_usec;
+  size_t idx = std::max(usec, (int64_t)0) / window_usec_;
+  if (idx != current_idx_) {
+    CloseWindow();
+    idx = std::max(usec, (int64_t)0) / window_usec_;
+    current_idx_ = idx;
+  }
+  for (int i = 0; i < Histogram::kNumBuckets; i++) {
+    uint64_t count = hist.bucket_count(i);
+    if (count > 0) {
+      current_[i >> kBucketShift] += count;
+      current_empty_ = false;
+    }
+  }
+}
+
+void Heatmap::CloseWindow()
+{
+  if (current_empty_) {
+    return;
+  }
+  if (windows_.size() <= current_idx_) {
+    windows_.resize(current_idx_ + 1);
+  }
+  // the window may already hold requests when windows were merged
+  Decode(windows_[current_idx_], current_);
+  Encode(current_, &windows_[current_idx_]);
+  memset(current_, 0, sizeof(current_));
+  current_empty_ = true;
+  while (windows_.size() > kMaxWindows) {
+    Compact();
+  }
+}
+
+void Heatmap::Compact()
+{
+  uint64_t counts[kNumBuckets];
+  vector<vector<uint8_t>> merged((windows_.size() + 1) / 2);
+
+  for (size_t i = 0; i < merged.size(); i++) {
+    memset(counts, 0, sizeof(counts));
+    Decode(windows_[2 * i], counts);
+    if (2 * i + 1 < windows_.size()) {
+      Decode(windows_[2 * i + 1], counts);
+    }
+    Encode(counts, &merged[i]);
+  }
+  windows_.swap(merged);
+  window_usec_ *= 2;
+  current_idx_ /= 2;
+}
+
+int Heatmap::Save(const string &path)
+{
+  CloseWindow();
+  std::ofstream os(path.c_str());
+  if (!os) {
+    log_error("failed to open '%s' for writing", path.c_str());
+    return RET_FAIL;
+  }
+  os << "# cloud-ping heatmap, window_usec " << window_usec_ << "\n";
+  os << "# start_sec\tlatency_low_usec\tlatency_high_usec\tcount\n";
+  for (size_t w = 0; w < windows_.size(); w++) {
+    uint64_t counts[kNumBuckets];
+    memset(counts, 0, sizeof(counts));
+    Decode(windows_[w], counts);
+    for (int i = 0; i < kNumBuckets; i++) {
+      if (counts[i] > 0) {
+        os << w * window_usec_ / 1000000.0 << "\t" << BucketLow(i) << "\t"
+           << BucketHigh(i) << "\t" << counts[i] << "\n";
+      }
+    }
+  }
+  if (!os) {
+    log_error("failed to write '%s'", path.c_str());
+    return RET_FAIL;
+  }
+  return RET_OK;
+}
+
+void Heatmap::Render()
+{
+  CloseWindow();
+  if (windows_.empty()) {
+    return;
+  }
+
+  // windows per column and buckets per row so the map fits the terminal
+  size_t per_column = (windows_.size() + HEATMAP_COLUMNS - 1) / HEATMAP_COLUMNS;
+  size_t columns = (windows_.size() + per_column - 1) / per_column;
+  vector<uint64_t> cells(columns * kNumBuckets, 0);
+  int lowest = kNumBuckets;
+  int highest = -1;
+  for (size_t w = 0; w < windows_.size(); w++) {
+    Decode(windows_[w], &cells[w / per_column * kNumBuckets]);
+  }
+  for (size_t c = 0; c < columns; c++) {
+    for (int i = 0; i < kNumBuckets; i++) {
+      if (cells[c * kNumBuckets + i] > 0) {
+        lowest = std::min(lowest, i);
+        highest = std::max(highest, i);
+      }
+    }
+  }
+  if (highest < 0) {
+    return;
+  }
+  int per_row = (highest - lowest + HEATMAP_ROWS) / HEATMAP_ROWS;
+  int rows = (highest - lowest) / per_row + 1;
+  vector<uint64_t> grid(rows * columns, 0);
+  uint64_t max_count = 0;
+  for (size_t c = 0; c < columns; c++) {
+    for (int i = lowest; i <= highest; i++) {
+      uint64_t &cell = grid[(i - lowest) / per_row * columns + c];
+      cell += cells[c * kNumBuckets + i];
+      max_count = std::max(max_count, cell);
+    }
+  }
+
+  double column_sec = per_column * window_usec_ / 1000000.0;
+  log_println("\nlatency heatmap, %.1f s per column, darker is more requests "
+              "(up to %ld per cell)", column_sec, max_count);
+  for (int r = rows - 1; r >= 0; r--) {
+    string line;
+    for (size_t c = 0; c < columns; c++) {
+      uint64_t count = grid[r * columns + c];
+      int shade = 0;
+      if (count > 0) {
+        int levels = sizeof(HEATMAP_SHADES) - 2;
+        shade = 1 + (int)(log((double)count) / log((double)max_count + 1) * levels);
+        shade = std::min(shade, levels);
+      }
+      line += HEATMAP_SHADES[shade];
+    }
+    log_println("  %9.3f ms |%s|", BucketLow(lowest + r * per_row) / 1000.0,
+                line.c_str());
+  }
+  log_println("  %12s +%s+", "", string(columns, '-').c_str());
+  string end = std::to_string((int)(columns * column_sec + 0.5)) + "s";
+  log_println("  %12s  0s%*s", "", (int)columns - 2, end.c_str());
+}
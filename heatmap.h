@@ -0,0 +1,57 @@
+#ifndef _HEATMAP_H_
+#define _HEATMAP_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+#include "histogram.h"
+
+using std::string;
+using std::vector;
+
+// Request latency over the run: a coarse log bucketed histogram per fixed
+// time window. Closed windows are kept as sparse, delta encoded buckets,
+// and once there are more than kMaxWindows, neighbours are merged and the
+// window doubles, so memory stays bounded however long the run.
+class Heatmap
+{
+public:
+  // kSubBuckets / 2^kBucketShift buckets per power of two of latency
+  static const int kBucketShift = 2;
+  static const int kNumBuckets = ((Histogram::kNumBuckets - 1) >> kBucketShift) + 1;
+  static const size_t kMaxWindows = 4096;
+
+  explicit Heatmap(uint64_t window_usec);
+  // the first call sets the time origin of the windows
+  void Start();
+  // adds the requests in 'hist', completed around 'now'
+  void Add(const struct timeval &now, const Histogram &hist);
+
+  // one 'start_sec latency_low_usec latency_high_usec count' line per non
+  // empty cell
+  int Save(const string &path);
+  void Render();
+
+  static uint64_t BucketLow(int idx);
+  static uint64_t BucketHigh(int idx);
+
+private:
+  void CloseWindow();
+  void Compact();
+  static void Encode(const uint64_t *counts, vector<uint8_t> *out);
+  static void Decode(const vector<uint8_t> &in, uint64_t *counts);
+
+  uint64_t window_usec_;
+  bool started_;
+  struct timeval start_;
+  // windows_[i] covers [i, i + 1) * window_usec_ since start_
+  vector<vector<uint8_t>> windows_;
+  // dense buckets of the window being recorded
+  uint64_t current_[kNumBuckets];
+  size_t current_idx_;
+  bool current_empty_;
+};
+
+#endif /* _HEATMAP_H_ */
@@ -0,0 +1,167 @@
+#include <sys/time.h>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <limits>
+
+#include "hedge.h"
+#include "cloud_conn.h"
+#include "stat_gen.h"
+#include "logging.h"
+
+// unhedged samples needed before hedging at the running p95
+static const uint64_t HEDGE_MIN_SAMPLES = 20;
+static const double HEDGE_PERCENTILE = 95;
+
+static uint64_t NowUsec()
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return now.tv_sec * 1000000ULL + now.tv_usec;
+}
+
+Hedger::Hedger(uint64_t delay_usec, size_t targets):
+  delay_usec_(delay_usec), hedge_conn_(NULL), targets_(targets)
+{
+}
+
+uint64_t Hedger::GetDelayUsec(size_t target) const
+{
+  if (delay_usec_ > 0) {
+    return delay_usec_;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  const Histogram &h = targets_[target].unhedged.time_usec;
+  if (h.count() < HEDGE_MIN_SAMPLES) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  return h.Percentile(HEDGE_PERCENTILE);
+}
+
+void Hedger::PerformGet(size_t target, CloudConnection *conn, Statistics *stat)
+{
+  bool hedge;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    hedge = targets_[target].calls++ % 2 == 1;
+  }
+  PerformRace(target, conn, stat, hedge);
+}
+
+// the original copy runs on the worker thread, so it keeps the worker's
+// pinning, cpu accounting and thread local connections, the hedge copy runs
+// on a helper thread started with the request
+void Hedger::PerformRace(size_t target, CloudConnection *conn, Statistics *stat,
+                         bool hedge)
+{
+  // copy 0 is the original request, copy 1 the hedge
+  Statistics copies[2];
+  uint64_t end_usec[2] = {0, 0};
+  bool done[2] = {false, false};
+  int launched = 1;
+  int winner = -1;
+  std::atomic<bool> cancel(false);
+  std::mutex race_mutex;
+  std::condition_variable race_cv;
+
+  auto run = [&](int idx, CloudConnection *c) {
+    copies[idx].set_cancel(&cancel);
+    c->PerformGet(&copies[idx]);
+    std::lock_guard<std::mutex> lock(race_mutex);
+    done[idx] = true;
+    end_usec[idx] = NowUsec();
+    // the first success wins, if all copies failed the last one, and
+    // cancels the other copy
+    if (winner < 0 &&
+        (copies[idx].IsSuccess() || launched == 1 || (done[0] && done[1]))) {
+      winner = idx;
+      cancel = true;
+    }
+    race_cv.notify_all();
+  };
+
+  uint64_t delay_usec = hedge ? GetDelayUsec(target) :
+    std::numeric_limits<uint64_t>::max();
+  uint64_t start = NowUsec();
+  std::thread helper;
+  if (delay_usec != std::numeric_limits<uint64_t>::max()) {
+    helper = std::thread([&] {
+        std::unique_lock<std::mutex> lock(race_mutex);
+        race_cv.wait_for(lock, std::chrono::microseconds(delay_usec),
+                         [&] { return winner >= 0; });
+        if (winner >= 0 || StatGenerator::IsExiting()) {
+          return;
+        }
+        launched = 2;
+        lock.unlock();
+        run(1, hedge_conn_ != NULL ? hedge_conn_ : conn);
+      });
+  }
+  run(0, conn);
+  {
+    std::unique_lock<std::mutex> lock(race_mutex);
+    race_cv.wait(lock, [&] { return winner >= 0; });
+  }
+  if (helper.joinable()) {
+    helper.join();
+  }
+
+  *stat = copies[winner];
+  stat->set_cancel(NULL);
+  // a winning hedge is as late as the request it replaced
+  if (winner == 1) {
+    stat->InheritStart(copies[0]);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  Target &t = targets_[target];
+  Arm &arm = hedge ? t.hedged : t.unhedged;
+  arm.requests++;
+  if (!stat->IsSuccess()) {
+    arm.failures++;
+  }
+  arm.time_usec.Record(end_usec[winner] - start);
+  if (launched == 2) {
+    t.hedges++;
+    if (winner == 1) {
+      t.hedge_wins++;
+    }
+    t.extra_bytes += copies[1 - winner].get_data_size();
+  }
+}
+
+static void DumpArm(const char *name, const Histogram &h, uint64_t requests,
+                    uint64_t failures)
+{
+  log_println("  %-9s %8ld %6ld %8.2f %8.2f %8.2f %8.2f %8.2f", name, requests,
+              failures, h.Percentile(50) / 1000.0, h.Percentile(90) / 1000.0,
+              h.Percentile(99) / 1000.0, h.Percentile(99.9) / 1000.0,
+              h.max() / 1000.0);
+}
+
+void Hedger::Dump(const vector<string> &urls) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < targets_.size(); i++) {
+    const Target &t = targets_[i];
+    if (delay_usec_ > 0) {
+      log_println("\nhedging %s (delay %.2f ms)", urls[i].c_str(),
+                  delay_usec_ / 1000.0);
+    }
+    else {
+      log_println("\nhedging %s (delay p%.0f of unhedged, now %.2f ms)",
+                  urls[i].c_str(), HEDGE_PERCENTILE,
+                  t.unhedged.time_usec.Percentile(HEDGE_PERCENTILE) / 1000.0);
+    }
+    log_println("  %-9s %8s %6s %8s %8s %8s %8s %8s (ms)", "", "requests",
+                "failed", "p50", "p90", "p99", "p99.9", "max");
+    DumpArm("unhedged", t.unhedged.time_usec, t.unhedged.requests,
+            t.unhedged.failures);
+    DumpArm("hedged", t.hedged.time_usec, t.hedged.requests, t.hedged.failures);
+    log_println("  %ld hedges = %.1f%% extra requests, %.2f MB extra received by "
+                "cancelled copies, hedge won %ld",
+                t.hedges,
+                t.hedged.requests > 0 ? t.hedges * 100.0 / t.hedged.requests : 0,
+                t.extra_bytes / 1048576.0, t.hedge_wins);
+  }
+}
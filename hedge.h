@@ -0,0 +1,57 @@
+#ifndef _HEDGE_H_
+#define _HEDGE_H_
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+#include "histogram.h"
+
+using std::string;
+using std::vector;
+
+class CloudConnection;
+class Statistics;
+
+// Hedged requests: when a request has not completed after the hedge delay
+// a second copy is sent, to the same or a hedge target, the first
+// successful copy is used and the other one is cancelled. Every other
+// request of a target runs unhedged so both arms see the same conditions.
+class Hedger
+{
+public:
+  // delay_usec 0 hedges at the running p95 of the unhedged requests
+  Hedger(uint64_t delay_usec, size_t targets);
+  void SetHedgeConnection(CloudConnection *conn) { hedge_conn_ = conn; }
+  // fills 'stat' with the copy that was used
+  void PerformGet(size_t target, CloudConnection *conn, Statistics *stat);
+  void Dump(const vector<string> &urls) const;
+
+private:
+  struct Arm {
+    Histogram time_usec;
+    uint64_t requests;
+    uint64_t failures;
+    Arm(): requests(0), failures(0) {}
+  };
+  struct Target {
+    Arm unhedged;
+    Arm hedged;
+    // requests so far, picks the arm
+    uint64_t calls;
+    uint64_t hedges;
+    uint64_t hedge_wins;
+    uint64_t extra_bytes;
+    Target(): calls(0), hedges(0), hedge_wins(0), extra_bytes(0) {}
+  };
+  uint64_t GetDelayUsec(size_t target) const;
+  void PerformRace(size_t target, CloudConnection *conn, Statistics *stat,
+                   bool hedge);
+
+  uint64_t delay_usec_;
+  CloudConnection *hedge_conn_;
+  mutable std::mutex mutex_;
+  vector<Target> targets_;
+};
+
+#endif /* _HEDGE_H_ */
@@ -0,0 +1,115 @@
+#include <string.h>
+
+#include "histogram.h"
+
+Histogram::Histogram()
+{
+  Reset();
+}
+
+void Histogram::Reset()
+{
+  memset(counts_, 0, sizeof(counts_));
+  count_ = 0;
+  sum_ = 0;
+  min_ = 0;
+  max_ = 0;
+}
+
+void Histogram::Merge(const Histogram &other)
+{
+  if (other.count_ == 0) {
+    return;
+  }
+  for (int i = 0; i < kNumBuckets; i++) {
+    counts_[i] += other.counts_[i];
+  }
+  if (count_ == 0 || other.min_ < min_) {
+    min_ = other.min_;
+  }
+  if (other.max_ > max_) {
+    max_ = other.max_;
+  }
+  count_ += other.count_;
+  sum_ += other.sum_;
+}
+
+uint64_t Histogram::Percentile(double percent) const
+{
+  if (count_ == 0) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t)(percent / 100.0 * count_ + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (int i = 0; i < kNumBuckets; i++) {
+    seen += counts_[i];
+    if (seen >= rank) {
+      uint64_t value = BucketHigh(i);
+      if (value > max_) {
+        value = max_;
+      }
+      if (value < min_) {
+        value = min_;
+      }
+      return value;
+    }
+  }
+  return max_;
+}
+
+/* static */
+uint64_t Histogram::BucketLow(int idx)
+{
+  if (idx < kSubBuckets) {
+    return idx;
+  }
+  int shift = idx / kSubBuckets - 1;
+  return (uint64_t)(kSubBuckets + idx % kSubBuckets) << shift;
+}
+
+/* static */
+uint64_t Histogram::BucketHigh(int idx)
+{
+  if (idx < kSubBuckets) {
+    return idx;
+  }
+  int shift = idx / kSubBuckets - 1;
+  return ((uint64_t)(kSubBuckets + idx % kSubBuckets + 1) << shift) - 1;
+}
+
+void Histogram::Save(std::ostream &os) const
+{
+  int buckets = 0;
+  for (int i = 0; i < kNumBuckets; i++) {
+    if (counts_[i] > 0) {
+      buckets++;
+    }
+  }
+  os << count_ << " " << sum_ << " " << min_ << " " << max_ << " " << buckets;
+  for (int i = 0; i < kNumBuckets; i++) {
+    if (counts_[i] > 0) {
+      os << " " << i << " " << counts_[i];
+    }
+  }
+}
+
+bool Histogram::Load(std::istream &is)
+{
+  int buckets;
+  Reset();
+  if (!(is >> count_ >> sum_ >> min_ >> max_ >> buckets)) {
+    return false;
+  }
+  for (int i = 0; i < buckets; i++) {
+    int idx;
+    uint64_t count;
+    if (!(is >> idx >> count) || idx < 0 || idx >= kNumBuckets) {
+      return false;
+    }
+    counts_[idx] = count;
+  }
+  return true;
+}
@@ -0,0 +1,76 @@
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <stdint.h>
+#include <iostream>
+
+// Log-linear histogram of non negative integer samples. Every power of two
+// is split into kSubBuckets linear buckets, so a reported percentile is
+// within 1/kSubBuckets of the recorded value. Buckets live in a fixed array:
+// recording never allocates and histograms merge by adding counts.
+class Histogram
+{
+public:
+  static const int kSubBucketBits = 4;
+  static const int kSubBuckets = 1 << kSubBucketBits;
+  static const int kMaxValueBits = 40;
+  static const int kNumBuckets = (kMaxValueBits - kSubBucketBits + 1) * kSubBuckets;
+
+  Histogram();
+  void Reset();
+  void Record(uint64_t value) { Record(value, 1); }
+  void Record(uint64_t value, uint64_t n);
+  void Merge(const Histogram &other);
+
+  uint64_t count() const { return count_; }
+  uint64_t sum() const { return sum_; }
+  uint64_t min() const { return count_ > 0 ? min_ : 0; }
+  uint64_t max() const { return max_; }
+  double mean() const { return count_ > 0 ? (double)sum_ / count_ : 0; }
+  uint64_t bucket_count(int idx) const { return counts_[idx]; }
+  uint64_t Percentile(double percent) const;
+
+  // one line 'count sum min max buckets [idx count]...' with the non
+  // empty buckets only
+  void Save(std::ostream &os) const;
+  bool Load(std::istream &is);
+
+  static int BucketIndex(uint64_t value);
+  static uint64_t BucketLow(int idx);
+  static uint64_t BucketHigh(int idx);
+
+private:
+  uint64_t counts_[kNumBuckets];
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t min_;
+  uint64_t max_;
+};
+
+inline int Histogram::BucketIndex(uint64_t value)
+{
+  if (value < (uint64_t)kSubBuckets) {
+    return value;
+  }
+  int msb = 63 - __builtin_clzll(value);
+  if (msb >= kMaxValueBits) {
+    return kNumBuckets - 1;
+  }
+  int shift = msb - kSubBucketBits;
+  return (shift + 1) * kSubBuckets + (int)((value >> shift) - kSubBuckets);
+}
+
+inline void Histogram::Record(uint64_t value, uint64_t n)
+{
+  counts_[BucketIndex(value)] += n;
+  if (count_ == 0 || value < min_) {
+    min_ = value;
+  }
+  if (value > max_) {
+    max_ = value;
+  }
+  count_ += n;
+  sum_ += value * n;
+}
+
+#endif /* _HISTOGRAM_H_ */
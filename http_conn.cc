@@ -6,8 +6,9 @@ void HttpConnection::PerformGet(Statistics *stat)
 {
   HttpReq req;
   stat->set_url(url_);
-  req.SetUrl("http://" + url_);
+  req.SetUrl(scheme() + url_);
   ApplyLimits(&req);
+  ApplyReqOptions(&req);
   req.ReportEvents(stat);
   req.PerformGet();
 }
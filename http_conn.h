@@ -6,8 +6,8 @@
 class HttpConnection : public CloudConnection
 {
 public:
-  HttpConnection(const string &url, const string &auth):
-    CloudConnection(url, auth) {}
+  HttpConnection(const string &url, const string &auth, bool secure):
+    CloudConnection(url, auth, secure) {}
   virtual void PerformGet(Statistics *stat);
 
 };
@@ -0,0 +1,646 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+#include <atomic>
+#include "logging.h"
+
+#include "http_raw.h"
+
+static const size_t RAW_MAX_LINE = 8192;
+// longest wait between checks of cancellation and deadlines
+static const int RAW_POLL_MSEC = 100;
+
+// bumped by ResetConnections, threads drop their idle connections when
+// they see a new value
+static std::atomic<uint64_t> raw_generation_g(0);
+
+static uint64_t ElapsedUsec(const struct timeval &since)
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return (now.tv_sec - since.tv_sec) * 1000000ULL + now.tv_usec - since.tv_usec;
+}
+
+bool ParseRawUrl(const string &url, RawUrl *parsed)
+{
+  static const string scheme = "http://";
+
+  if (url.compare(0, scheme.size(), scheme) != 0) {
+    return false;
+  }
+  size_t host_start = scheme.size();
+  size_t path_start = url.find('/', host_start);
+  if (path_start == string::npos) {
+    path_start = url.size();
+  }
+  string authority = url.substr(host_start, path_start - host_start);
+  size_t colon = authority.rfind(':');
+  if (colon != string::npos && authority.find(']', colon) == string::npos) {
+    parsed->host = authority.substr(0, colon);
+    parsed->port = authority.substr(colon + 1);
+  }
+  else {
+    parsed->host = authority;
+    parsed->port = "80";
+  }
+  if (!parsed->host.empty() && parsed->host[0] == '[') {
+    parsed->host = parsed->host.substr(1, parsed->host.size() - 2);
+  }
+  parsed->path = path_start < url.size() ? url.substr(path_start) : "/";
+  parsed->key = authority;
+  return !parsed->host.empty() && !parsed->port.empty();
+}
+
+RawHttpParser::RawHttpParser():
+  state_(STATUS_LINE), status_(0), keep_alive_(false),
+  chunked_(false), has_length_(false), remaining_(0)
+{
+}
+
+bool RawHttpParser::ReadLine(const char *data, size_t len, size_t *consumed)
+{
+  const char *end = (const char *)memchr(data, '\n', len);
+  size_t n = end != NULL ? end - data : len;
+
+  if (line_.size() + n > RAW_MAX_LINE) {
+    state_ = ERROR;
+    *consumed = len;
+    return false;
+  }
+  line_.append(data, n);
+  if (end == NULL) {
+    *consumed = len;
+    return false;
+  }
+  *consumed = n + 1;
+  if (!line_.empty() && line_.back() == '\r') {
+    line_.pop_back();
+  }
+  return true;
+}
+
+void RawHttpParser::ParseStatusLine()
+{
+  int minor;
+  unsigned long status;
+
+  if (sscanf(line_.c_str(), "HTTP/1.%d %lu", &minor, &status) != 2) {
+    state_ = ERROR;
+    return;
+  }
+  status_ = status;
+  keep_alive_ = minor >= 1;
+  chunked_ = false;
+  has_length_ = false;
+  state_ = HEADERS;
+}
+
+void RawHttpParser::ParseHeader()
+{
+  size_t colon = line_.find(':');
+  if (colon == string::npos) {
+    state_ = ERROR;
+    return;
+  }
+  const char *name = line_.c_str();
+  const char *value = name + colon + 1;
+  while (*value == ' ' || *value == '\t') {
+    value++;
+  }
+  if (colon == 14 && strncasecmp(name, "Content-Length", colon) == 0) {
+    char *end;
+    remaining_ = strtoull(value, &end, 10);
+    has_length_ = end != value;
+  }
+  else if (colon == 17 && strncasecmp(name, "Transfer-Encoding", colon) == 0) {
+    chunked_ = strcasestr(value, "chunked") != NULL;
+  }
+  else if (colon == 10 && strncasecmp(name, "Connection", colon) == 0) {
+    if (strcasestr(value, "close") != NULL) {
+      keep_alive_ = false;
+    }
+    else if (strcasestr(value, "keep-alive") != NULL) {
+      keep_alive_ = true;
+    }
+  }
+}
+
+void RawHttpParser::StartBody()
+{
+  if (status_ < 200) {
+    // interim response, the real one follows
+    state_ = STATUS_LINE;
+  }
+  else if (status_ == 204 || status_ == 304) {
+    state_ = DONE;
+  }
+  else if (chunked_) {
+    state_ = CHUNK_SIZE;
+  }
+  else if (has_length_) {
+    state_ = remaining_ > 0 ? BODY : DONE;
+  }
+  else {
+    keep_alive_ = false;
+    state_ = BODY_UNTIL_CLOSE;
+  }
+}
+
+size_t RawHttpParser::Feed(const char *data, size_t len, const char **body, size_t *body_len)
+{
+  size_t pos = 0;
+
+  *body = NULL;
+  *body_len = 0;
+  while (pos < len && state_ != DONE && state_ != ERROR) {
+    if (state_ == BODY || state_ == CHUNK_DATA) {
+      size_t n = std::min((uint64_t)(len - pos), remaining_);
+      *body = data + pos;
+      *body_len = n;
+      remaining_ -= n;
+      if (remaining_ == 0) {
+        state_ = state_ == BODY ? DONE : CHUNK_END;
+      }
+      return pos + n;
+    }
+    if (state_ == BODY_UNTIL_CLOSE) {
+      *body = data + pos;
+      *body_len = len - pos;
+      return len;
+    }
+
+    size_t used;
+    bool complete = ReadLine(data + pos, len - pos, &used);
+    pos += used;
+    if (!complete) {
+      continue;
+    }
+    switch (state_) {
+    case STATUS_LINE:
+      ParseStatusLine();
+      break;
+    case HEADERS:
+      if (line_.empty()) {
+        StartBody();
+      }
+      else {
+        ParseHeader();
+      }
+      break;
+    case CHUNK_SIZE: {
+      char *end;
+      remaining_ = strtoull(line_.c_str(), &end, 16);
+      if (end == line_.c_str()) {
+        state_ = ERROR;
+      }
+      else {
+        state_ = remaining_ > 0 ? CHUNK_DATA : TRAILERS;
+      }
+      break;
+    }
+    case CHUNK_END:
+      state_ = line_.empty() ? CHUNK_SIZE : ERROR;
+      break;
+    case TRAILERS:
+      if (line_.empty()) {
+        state_ = DONE;
+      }
+      break;
+    default:
+      break;
+    }
+    line_.clear();
+  }
+  return pos;
+}
+
+void RawHttpParser::Finish()
+{
+  if (state_ == BODY_UNTIL_CLOSE) {
+    state_ = DONE;
+  }
+  else if (state_ != DONE) {
+    state_ = ERROR;
+  }
+}
+
+RawHttpClient::RawHttpClient():
+  epoll_fd_(epoll_create1(EPOLL_CLOEXEC)), watched_fd_(-1), watched_events_(0),
+  generation_(raw_generation_g.load())
+{
+  if (epoll_fd_ < 0) {
+    log_error("Failed to create epoll instance errno=%d", errno);
+  }
+}
+
+RawHttpClient::~RawHttpClient()
+{
+  CloseIdle();
+  if (epoll_fd_ >= 0) {
+    close(epoll_fd_);
+  }
+}
+
+/* static */
+RawHttpClient *RawHttpClient::ForThread()
+{
+  static thread_local RawHttpClient client;
+  return &client;
+}
+
+/* static */
+void RawHttpClient::ResetConnections()
+{
+  raw_generation_g++;
+}
+
+void RawHttpClient::CloseIdle()
+{
+  for (auto &entry : idle_) {
+    for (int fd : entry.second) {
+      Close(fd);
+    }
+  }
+  idle_.clear();
+}
+
+bool RawHttpClient::Resolve(const RawUrl &url, struct sockaddr_storage *addr,
+                            socklen_t *len)
+{
+  auto it = addrs_.find(url.key);
+  if (it != addrs_.end()) {
+    *addr = it->second.addr;
+    *len = it->second.len;
+    return true;
+  }
+
+  struct addrinfo hints;
+  struct addrinfo *result;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  int ret = getaddrinfo(url.host.c_str(), url.port.c_str(), &hints, &result);
+  if (ret != 0) {
+    log_error("Failed to resolve %s: %s", url.host.c_str(), gai_strerror(ret));
+    return false;
+  }
+  Address &cached = addrs_[url.key];
+  memcpy(&cached.addr, result->ai_addr, result->ai_addrlen);
+  cached.len = result->ai_addrlen;
+  freeaddrinfo(result);
+  *addr = cached.addr;
+  *len = cached.len;
+  return true;
+}
+
+int RawHttpClient::Acquire(const RawUrl &url, const HttpReqOptions &options,
+                           bool *reused, ReqOutcome *outcome)
+{
+  uint64_t generation = raw_generation_g.load();
+  if (generation != generation_) {
+    CloseIdle();
+    addrs_.clear();
+    generation_ = generation;
+  }
+
+  auto it = idle_.find(url.key);
+  if (it != idle_.end() && !it->second.empty()) {
+    int fd = it->second.back();
+    it->second.pop_back();
+    *reused = true;
+    return fd;
+  }
+  *reused = false;
+
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+  if (!Resolve(url, &addr, &addr_len)) {
+    *outcome = REQ_DNS_ERROR;
+    return -1;
+  }
+  int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    log_error("Failed to create socket errno=%d", errno);
+    *outcome = REQ_OTHER_ERROR;
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (options.rcvbuf > 0) {
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &options.rcvbuf, sizeof(options.rcvbuf))) {
+      log_warn("failed to set SO_RCVBUF errno=%d", errno);
+    }
+  }
+  if (options.busy_poll_usec > 0) {
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &options.busy_poll_usec,
+                   sizeof(options.busy_poll_usec))) {
+      log_warn("failed to set SO_BUSY_POLL errno=%d", errno);
+    }
+  }
+  if (connect(fd, (struct sockaddr *)&addr, addr_len) != 0 && errno != EINPROGRESS) {
+    log_info("connect failed errno=%d", errno);
+    close(fd);
+    *outcome = REQ_CONNECT_ERROR;
+    return -1;
+  }
+  return fd;
+}
+
+void RawHttpClient::Release(const RawUrl &url, int fd, bool reusable)
+{
+  if (!reusable) {
+    Close(fd);
+    return;
+  }
+  // stays registered with epoll, a next request on it waits without
+  // touching the interest list
+  idle_[url.key].push_back(fd);
+}
+
+void RawHttpClient::Close(int fd)
+{
+  // closing removes the fd from the epoll interest list
+  if (fd == watched_fd_) {
+    watched_fd_ = -1;
+  }
+  close(fd);
+}
+
+uint32_t RawHttpClient::Wait(int fd, uint32_t events, int timeout_msec)
+{
+  struct epoll_event ev;
+
+  // only the connection in use is registered, an idle pooled one would
+  // keep reporting its peer's close
+  if (watched_fd_ >= 0 && fd != watched_fd_) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, watched_fd_, NULL);
+    watched_fd_ = -1;
+  }
+  if (fd != watched_fd_ || events != watched_events_) {
+    ev.events = events;
+    ev.data.fd = fd;
+    int op = fd == watched_fd_ ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(epoll_fd_, op, fd, &ev) != 0) {
+      log_error("Failed to watch fd=%d errno=%d", fd, errno);
+      return 0;
+    }
+    watched_fd_ = fd;
+    watched_events_ = events;
+  }
+  if (epoll_wait(epoll_fd_, &ev, 1, timeout_msec) <= 0) {
+    return 0;
+  }
+  return ev.events;
+}
+
+char *RawHttpClient::GetRecvBuf(size_t size)
+{
+  if (recv_buf_.size() < size) {
+    recv_buf_.resize(size);
+  }
+  return recv_buf_.data();
+}
+
+// 'GET path HTTP/1.1' and the headers written straight into buf, 0 if they
+// do not fit
+static size_t SerializeGet(const RawUrl &url, const vector<string> &headers,
+                           char *buf, size_t size)
+{
+  size_t len = 0;
+  auto append = [&](const char *data, size_t n) {
+    if (len + n <= size) {
+      memcpy(buf + len, data, n);
+    }
+    len += n;
+  };
+  auto append_str = [&](const string &s) { append(s.data(), s.size()); };
+
+  append("GET ", 4);
+  append_str(url.path);
+  append(" HTTP/1.1\r\nHost: ", 17);
+  append_str(url.key);
+  append("\r\nUser-Agent: cloud-ping\r\nAccept: */*\r\n", 39);
+  for (const string &header : headers) {
+    append_str(header);
+    append("\r\n", 2);
+  }
+  append("\r\n", 2);
+  return len <= size ? len : 0;
+}
+
+ReqOutcome HttpReq::RawCheckDeadlines(bool connecting, int *wait_msec)
+{
+  uint64_t elapsed_msec = ElapsedUsec(start_time_) / 1000;
+  long left = RAW_POLL_MSEC;
+
+  auto limit = [&](long deadline_msec) {
+    if (deadline_msec <= 0) {
+      return false;
+    }
+    if (elapsed_msec >= (uint64_t)deadline_msec) {
+      return true;
+    }
+    left = std::min(left, (long)(deadline_msec - elapsed_msec));
+    return false;
+  };
+  if (connecting && limit(options_.connect_timeout_msec)) {
+    return REQ_CONNECT_TIMEOUT;
+  }
+  if (!headers_received_ && limit(options_.ttfb_timeout_msec)) {
+    return REQ_TTFB_TIMEOUT;
+  }
+  if (limit(options_.timeout_msec)) {
+    return REQ_TIMEOUT;
+  }
+  *wait_msec = left;
+  return REQ_OK;
+}
+
+ReqOutcome HttpReq::RawExchange(RawHttpClient *client, int fd, size_t request_len,
+                                bool connecting, RawHttpParser *parser, bool *stale)
+{
+  const char *request = client->get_request_buf();
+  size_t buf_size = options_.buffer_size > 0 ? options_.buffer_size :
+    RawHttpClient::kDefaultRecvBufSize;
+  char *buf = client->GetRecvBuf(buf_size);
+  size_t sent = 0;
+  uint64_t received = 0;
+  bool readable = false;
+  uint64_t low_speed_start_usec = 0;
+  uint64_t low_speed_bytes = 0;
+
+  *stale = false;
+  while (true) {
+    int wait_msec;
+    ReqOutcome expired = RawCheckDeadlines(connecting, &wait_msec);
+    if (expired != REQ_OK) {
+      return expired;
+    }
+    if (events_->IsCancelled()) {
+      return REQ_CANCELLED;
+    }
+    // on every wake up, as curl, so a stream that stopped is aborted too
+    if (options_.low_speed_limit > 0 && !connecting) {
+      uint64_t now_usec = ElapsedUsec(start_time_);
+      if (now_usec - low_speed_start_usec >= (uint64_t)options_.low_speed_time * 1000000) {
+        if (low_speed_bytes < (uint64_t)(options_.low_speed_limit * options_.low_speed_time)) {
+          return REQ_LOW_SPEED;
+        }
+        low_speed_start_usec = now_usec;
+        low_speed_bytes = 0;
+      }
+    }
+
+    if (connecting) {
+      if (client->Wait(fd, EPOLLOUT, wait_msec) == 0) {
+        continue;
+      }
+      int err = 0;
+      socklen_t len = sizeof(err);
+      if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+        log_info("connect failed errno=%d", err);
+        return REQ_CONNECT_ERROR;
+      }
+      connecting = false;
+      low_speed_start_usec = ElapsedUsec(start_time_);
+      continue;
+    }
+
+    if (sent < request_len) {
+      if (sent == 0) {
+        events_->OnReqSendHeaders();
+      }
+      ssize_t n = send(fd, request + sent, request_len - sent, MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EAGAIN || errno == EINTR) {
+          client->Wait(fd, EPOLLOUT, wait_msec);
+          continue;
+        }
+        *stale = true;
+        return REQ_RESET;
+      }
+      sent += n;
+      continue;
+    }
+
+    if (!readable) {
+      if (client->Wait(fd, EPOLLIN, wait_msec) == 0) {
+        continue;
+      }
+      readable = true;
+    }
+    ssize_t n = recv(fd, buf, buf_size, 0);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EINTR) {
+        readable = false;
+        continue;
+      }
+      *stale = received == 0;
+      return REQ_RESET;
+    }
+    if (n == 0) {
+      parser->Finish();
+      if (parser->done()) {
+        return REQ_OK;
+      }
+      *stale = received == 0;
+      return REQ_RESET;
+    }
+    // a short read drained the socket
+    readable = (size_t)n == buf_size;
+    if (received == 0) {
+      headers_received_ = true;
+      events_->OnReqRecvHeaders();
+    }
+    received += n;
+
+    low_speed_bytes += n;
+
+    size_t pos = 0;
+    while (pos < (size_t)n) {
+      const char *body;
+      size_t body_len;
+      bool had_headers = parser->headers_done();
+      pos += parser->Feed(buf + pos, n - pos, &body, &body_len);
+      if (parser->error()) {
+        log_error("Malformed response from %s", url_.c_str());
+        return REQ_OTHER_ERROR;
+      }
+      if (!had_headers && parser->headers_done()) {
+        events_->OnReqRecvHeaders();
+        // as curl with CURLOPT_FAILONERROR, the body is not read
+        if (parser->get_status() >= 400) {
+          return REQ_HTTP_ERROR;
+        }
+      }
+      if (body_len > 0) {
+        events_->OnReqRecvData(body_len);
+        recv_size_ += body_len;
+        if (recv_limit_ > 0 && recv_size_ > recv_limit_) {
+          truncated_ = true;
+          return REQ_TRUNCATED;
+        }
+      }
+      if (parser->done()) {
+        return REQ_OK;
+      }
+    }
+  }
+}
+
+void HttpReq::RawPerformGet()
+{
+  RawUrl url;
+  unsigned long http_code = 0;
+  ReqOutcome outcome = REQ_OTHER_ERROR;
+
+  gettimeofday(&start_time_, NULL);
+  events_->OnReqStart();
+  if (!ParseRawUrl(url_, &url)) {
+    log_error("The raw engine only fetches http:// urls, not %s", url_.c_str());
+    events_->OnComplete(http_code, outcome);
+    return;
+  }
+  RawHttpClient *client = RawHttpClient::ForThread();
+  size_t request_len = SerializeGet(url, headers_, client->get_request_buf(),
+                                    RawHttpClient::kRequestBufSize);
+  if (request_len == 0) {
+    log_error("Request to %s exceeds %zu bytes", url_.c_str(),
+              RawHttpClient::kRequestBufSize);
+    events_->OnComplete(http_code, outcome);
+    return;
+  }
+
+  // a pooled connection the server closed meanwhile fails before the first
+  // response byte, the request is retried once on a new connection
+  for (int attempt = 0; attempt < 2; attempt++) {
+    bool reused;
+    int fd = client->Acquire(url, options_, &reused, &outcome);
+    if (fd < 0) {
+      break;
+    }
+    RawHttpParser parser;
+    bool stale;
+    outcome = RawExchange(client, fd, request_len, !reused, &parser, &stale);
+    if (stale && reused && attempt == 0) {
+      client->Close(fd);
+      continue;
+    }
+    if (outcome != REQ_CONNECT_ERROR && outcome != REQ_CONNECT_TIMEOUT) {
+      ReportTcpInfo(fd);
+    }
+    http_code = parser.get_status();
+    client->Release(url, fd, options_.keep_alive && outcome == REQ_OK &&
+                    parser.done() && parser.get_keep_alive());
+    break;
+  }
+  events_->OnComplete(http_code, outcome);
+}
@@ -0,0 +1,119 @@
+#ifndef _HTTP_RAW_H_
+#define _HTTP_RAW_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <sys/socket.h>
+
+#include "http_req.h"
+
+using std::string;
+using std::vector;
+
+// host, port and path of a plain http url, key names the connection pool
+struct RawUrl
+{
+  string host;
+  string port;
+  string path;
+  string key;
+};
+
+bool ParseRawUrl(const string &url, RawUrl *parsed);
+
+// Incremental HTTP/1.1 response parser. The status line and headers are
+// buffered until each line is complete, the body is never copied: Feed
+// points into the caller's buffer at the next body bytes.
+class RawHttpParser
+{
+public:
+  RawHttpParser();
+  // consumes at most len bytes, stops after a run of body bytes so the
+  // caller sees them before parsing goes on; returns the bytes consumed
+  size_t Feed(const char *data, size_t len, const char **body, size_t *body_len);
+  // the peer closed the connection
+  void Finish();
+
+  bool has_status() const { return state_ > STATUS_LINE; }
+  bool headers_done() const { return state_ > HEADERS; }
+  bool done() const { return state_ == DONE; }
+  bool error() const { return state_ == ERROR; }
+  unsigned long get_status() const { return status_; }
+  bool get_keep_alive() const { return keep_alive_; }
+
+private:
+  enum State {
+    STATUS_LINE,
+    HEADERS,
+    BODY,
+    BODY_UNTIL_CLOSE,
+    CHUNK_SIZE,
+    CHUNK_DATA,
+    CHUNK_END,
+    TRAILERS,
+    DONE,
+    ERROR
+  };
+  bool ReadLine(const char *data, size_t len, size_t *consumed);
+  void ParseStatusLine();
+  void ParseHeader();
+  void StartBody();
+
+  State state_;
+  string line_;
+  unsigned long status_;
+  bool keep_alive_;
+  bool chunked_;
+  bool has_length_;
+  uint64_t remaining_;
+};
+
+// Per thread state of the raw engine: an epoll instance, idle connections
+// by host, resolved addresses and the request and receive buffers, all
+// allocated once and reused by every request of the thread.
+class RawHttpClient
+{
+public:
+  static const size_t kRequestBufSize = 8192;
+  static const size_t kDefaultRecvBufSize = 65536;
+
+  ~RawHttpClient();
+  static RawHttpClient *ForThread();
+  // closes the idle connections of every thread before their next request
+  static void ResetConnections();
+
+  // an idle connection to the url's host or a new one with a connect in
+  // progress, -1 with the reason in outcome on failure
+  int Acquire(const RawUrl &url, const HttpReqOptions &options,
+              bool *reused, ReqOutcome *outcome);
+  void Release(const RawUrl &url, int fd, bool reusable);
+  void Close(int fd);
+  // ready epoll events of fd, 0 on timeout
+  uint32_t Wait(int fd, uint32_t events, int timeout_msec);
+
+  char *get_request_buf() { return request_buf_; }
+  char *GetRecvBuf(size_t size);
+
+private:
+  RawHttpClient();
+  bool Resolve(const RawUrl &url, struct sockaddr_storage *addr, socklen_t *len);
+  void CloseIdle();
+
+  struct Address {
+    struct sockaddr_storage addr;
+    socklen_t len;
+  };
+
+  int epoll_fd_;
+  int watched_fd_;
+  uint32_t watched_events_;
+  uint64_t generation_;
+  std::map<string, vector<int>> idle_;
+  std::map<string, Address> addrs_;
+  char request_buf_[kRequestBufSize];
+  vector<char> recv_buf_;
+};
+
+#endif /* _HTTP_RAW_H_ */
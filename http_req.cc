@@ -1,18 +1,43 @@
 
 #include <openssl/crypto.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
 #include <gcrypt.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <poll.h>
+#include <algorithm>
+#include <atomic>
+#include <netinet/in.h>
+#include <linux/tcp.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
 #include "boost/format.hpp"
 #include "logging.h"
 #include "errors.h"
 
 #include "http_req.h"
+#include "http_raw.h"
 
 using boost::format;
 
+static const int RX_TIMESTAMP_WAIT_MSEC = 30000;
+// slices of the wait, to notice a cancelled request
+static const int RX_TIMESTAMP_POLL_MSEC = 100;
+
 static pthread_mutex_t *openssl_locks;
 static int num_openssl_locks;
 
+static CURLSH *curl_share;
+static pthread_mutex_t curl_share_locks[CURL_LOCK_DATA_LAST];
+// bumped by ResetConnections, threads drop their keep-alive share when they
+// see a new value
+static std::atomic<uint64_t> curl_generation_g(0);
+static X509_STORE *ca_store;
+
 GCRY_THREAD_OPTION_PTHREAD_IMPL;
 
 static void openssl_locking_callback(int mode, int i, const char *file, int line)
@@ -30,12 +55,81 @@ static u_long openssl_id_callback(void)
   return (u_long)pthread_self();
 }
 
+static void curl_share_lock_callback(CURL *handle, curl_lock_data data,
+                                     curl_lock_access access, void *userptr)
+{
+  pthread_mutex_lock(&curl_share_locks[data]);
+}
+
+static void curl_share_unlock_callback(CURL *handle, curl_lock_data data,
+                                       void *userptr)
+{
+  pthread_mutex_unlock(&curl_share_locks[data]);
+}
+
+// libcurl does not support a connection cache used by concurrent threads,
+// with --keep-alive each thread pools its connections and tls sessions in
+// a share of its own, as the raw engine's RawHttpClient
+class CurlThreadShare
+{
+public:
+  CurlThreadShare(): share_(NULL), generation_(0) {}
+  ~CurlThreadShare()
+  {
+    if (share_ != NULL) {
+      curl_share_cleanup(share_);
+    }
+  }
+
+  // no request of the thread may be running
+  CURLSH *Get()
+  {
+    uint64_t generation = curl_generation_g.load();
+    if (share_ != NULL && generation != generation_) {
+      curl_share_cleanup(share_);
+      share_ = NULL;
+    }
+    if (share_ == NULL) {
+      share_ = curl_share_init();
+      if (share_ == NULL) {
+        return NULL;
+      }
+      curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+      curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+      generation_ = generation;
+    }
+    return share_;
+  }
+
+  static CurlThreadShare *ForThread()
+  {
+    static thread_local CurlThreadShare share;
+    return &share;
+  }
+
+private:
+  CURLSH *share_;
+  uint64_t generation_;
+};
+
+static CURLcode http_ssl_ctx_callback(CURL *curl, void *ssl_ctx, void *userptr)
+{
+  // the store is loaded once in LoadCaStore and shared by every SSL_CTX
+  X509_STORE_up_ref(ca_store);
+  SSL_CTX_set_cert_store((SSL_CTX *)ssl_ctx, ca_store);
+  return CURLE_OK;
+}
+
 static int http_sockopt_callback(void *clientp, curl_socket_t curlfd, curlsocktype purpose)
 {
-  int i = 1;
-  if(setsockopt(curlfd, SOL_SOCKET, SO_REUSEADDR, &i, sizeof(i)))
-    return CURL_SOCKOPT_ERROR;
-  return CURL_SOCKOPT_OK;
+  HttpReq *req = (HttpReq *)clientp;
+  return req->CurlSockoptCallback(curlfd);
+}
+
+static int http_closesocket_callback(void *clientp, curl_socket_t curlfd)
+{
+  HttpReq *req = (HttpReq *)clientp;
+  return req->CurlCloseSocketCallback(curlfd);
 }
 
 static size_t http_read_callback(char *ptr, size_t size, size_t nmemb, void *userdata)
@@ -50,16 +144,59 @@ static size_t http_write_callback(char *ptr, size_t size, size_t nmemb, void *us
   return req->CurlWriteCallback(ptr, size*nmemb);
 }
 
+static int http_progress_callback(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
+                                  curl_off_t ultotal, curl_off_t ulnow)
+{
+  HttpReq *req = (HttpReq *)clientp;
+  return req->CurlProgressCallback(dltotal, dlnow, ultotal, ulnow);
+}
+
 static int http_debug_callback(CURL *curl, curl_infotype infotype, char *buf, size_t len, void *userdata)
 {
   HttpReq *req = (HttpReq*)userdata;
   return req->CurlDebugCallback(curl, infotype, buf, len);
 }
 
+HttpReqOptions::HttpReqOptions():
+  kernel_timestamps(false), buffer_size(0), rcvbuf(0), keep_alive(false),
+  connect_timeout_msec(0), ttfb_timeout_msec(0), timeout_msec(0),
+  low_speed_limit(0), low_speed_time(0), engine(HTTP_ENGINE_CURL),
+  busy_poll_usec(0)
+{
+}
+
+static const int TTFB_POLL_MAX_MSEC = 1000;
+
+static const char *REQ_OUTCOME_NAMES[REQ_OUTCOMES] = {
+  "ok",
+  "truncated",
+  "http error",
+  "dns error",
+  "connect error",
+  "connect timeout",
+  "tls error",
+  "reset",
+  "ttfb timeout",
+  "low speed",
+  "timeout",
+  "cancelled",
+  "other error",
+};
+
+const char *ReqOutcomeName(int outcome)
+{
+  return outcome >= 0 && outcome < REQ_OUTCOMES ? REQ_OUTCOME_NAMES[outcome] : "?";
+}
+
 HttpReq::HttpReq():
-  recv_limit_(0), recv_size_(0),
-  curl_(curl_easy_init()), curl_headers_(nullptr)
+  events_(nullptr), recv_limit_(0), recv_size_(0), tls_captured_(false),
+  socket_(CURL_SOCKET_BAD), tcp_captured_(false), rx_timestamp_peeked_(false),
+  headers_received_(false), truncated_(false), cancelled_(false),
+  ttfb_timed_out_(false),
+  curl_(nullptr), curl_headers_(nullptr)
 {
+  memset(&tls_info_, 0, sizeof(tls_info_));
+  memset(&start_time_, 0, sizeof(start_time_));
 }
 
 HttpReq::~HttpReq()
@@ -104,6 +241,11 @@ void HttpReq::AddGetRangeHeader(uint64_t start, uint64_t end)
   };
 }
 
+void HttpReq::SetOptions(const HttpReqOptions &options)
+{
+  options_ = options;
+}
+
 void HttpReq::ReportEvents(HttpReqEvents *events)
 {
   events_ = events;
@@ -125,21 +267,57 @@ void HttpReq::SetCurlOptions()
 {
   curl_easy_setopt(curl_, CURLOPT_VERBOSE, 1);
 
-  // curl_easy_setopt(curl, CURLOPT_TIMEOUT, download_timeout_);
+  if (options_.connect_timeout_msec > 0) {
+    curl_easy_setopt(curl_, CURLOPT_CONNECTTIMEOUT_MS, options_.connect_timeout_msec);
+  }
+  if (options_.timeout_msec > 0) {
+    curl_easy_setopt(curl_, CURLOPT_TIMEOUT_MS, options_.timeout_msec);
+  }
+  if (options_.low_speed_limit > 0 && options_.low_speed_time > 0) {
+    curl_easy_setopt(curl_, CURLOPT_LOW_SPEED_LIMIT, options_.low_speed_limit);
+    curl_easy_setopt(curl_, CURLOPT_LOW_SPEED_TIME, options_.low_speed_time);
+  }
   curl_easy_setopt(curl_, CURLOPT_ERRORBUFFER, curl_error_buffer_);
   curl_easy_setopt(curl_, CURLOPT_FAILONERROR, 1);
   curl_easy_setopt(curl_, CURLOPT_FOLLOWLOCATION, 1);
   curl_easy_setopt(curl_, CURLOPT_NOSIGNAL, 1);
-  curl_easy_setopt(curl_, CURLOPT_NOPROGRESS, 1);
+  // the progress callback lets the events cancel the request
+  curl_easy_setopt(curl_, CURLOPT_NOPROGRESS, 0);
+  curl_easy_setopt(curl_, CURLOPT_XFERINFOFUNCTION, http_progress_callback);
+  curl_easy_setopt(curl_, CURLOPT_XFERINFODATA, this);
   curl_easy_setopt(curl_, CURLOPT_PRIVATE, this);
 
   curl_easy_setopt(curl_, CURLOPT_URL, url_.c_str());
   curl_easy_setopt(curl_, CURLOPT_HTTPHEADER, curl_headers_);
 
-  curl_easy_setopt(curl_, CURLOPT_SSL_VERIFYPEER, 0);
+  curl_easy_setopt(curl_, CURLOPT_SHARE, options_.keep_alive ?
+                   CurlThreadShare::ForThread()->Get() : curl_share);
+  if (options_.buffer_size > 0) {
+    curl_easy_setopt(curl_, CURLOPT_BUFFERSIZE, options_.buffer_size);
+  }
+  if (options_.kernel_timestamps) {
+    // the peek relies on the request being on the wire when its headers
+    // are reported, which is not the case for HTTP/2
+    curl_easy_setopt(curl_, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+  }
+  if (ca_store != NULL) {
+    curl_easy_setopt(curl_, CURLOPT_SSL_VERIFYPEER, 1);
+    curl_easy_setopt(curl_, CURLOPT_SSL_VERIFYHOST, 2);
+    curl_easy_setopt(curl_, CURLOPT_CAINFO, NULL);
+    curl_easy_setopt(curl_, CURLOPT_CAPATH, NULL);
+    curl_easy_setopt(curl_, CURLOPT_SSL_CTX_FUNCTION, http_ssl_ctx_callback);
+  }
+  else {
+    curl_easy_setopt(curl_, CURLOPT_SSL_VERIFYPEER, 0);
+  }
 
   curl_easy_setopt(curl_, CURLOPT_SOCKOPTFUNCTION, http_sockopt_callback);
-  curl_easy_setopt(curl_, CURLOPT_SOCKOPTDATA, 0);
+  curl_easy_setopt(curl_, CURLOPT_SOCKOPTDATA, this);
+  // pooled connections outlive the request that opened them
+  if (!options_.keep_alive) {
+    curl_easy_setopt(curl_, CURLOPT_CLOSESOCKETFUNCTION, http_closesocket_callback);
+    curl_easy_setopt(curl_, CURLOPT_CLOSESOCKETDATA, this);
+  }
 
   curl_easy_setopt(curl_, CURLOPT_WRITEFUNCTION, http_write_callback);
   curl_easy_setopt(curl_, CURLOPT_WRITEDATA, this);
@@ -159,20 +337,346 @@ void HttpReq::SetDataLimit(size_t len)
 
 void HttpReq::InvokeCurl()
 {
-  unsigned long http_code;
-  curl_easy_perform(curl_);
+  unsigned long http_code = 0;
+  gettimeofday(&start_time_, NULL);
+  events_->OnReqStart();
+  CURLcode res = options_.ttfb_timeout_msec > 0 ? PerformWithTtfbTimeout() :
+    curl_easy_perform(curl_);
   curl_easy_getinfo(curl_, CURLINFO_RESPONSE_CODE, &http_code);
-  events_->OnComplete(http_code);
+  ReqOutcome outcome = ClassifyResult(res);
+  if (outcome != REQ_OK && outcome != REQ_TRUNCATED) {
+    log_info("request failed: %s (%s)", ReqOutcomeName(outcome),
+             curl_error_buffer_[0] ? curl_error_buffer_ : curl_easy_strerror(res));
+  }
+  ReportTlsInfo();
+  CaptureTcpInfo();
+  events_->OnComplete(http_code, outcome);
+}
+
+// curl has no deadline for the first response byte, drive the transfer
+// through a multi handle and wake up in time to check it
+CURLcode HttpReq::PerformWithTtfbTimeout()
+{
+  CURLM *multi = curl_multi_init();
+  CURLcode res = CURLE_OK;
+  int running = 1;
+
+  curl_multi_add_handle(multi, curl_);
+  while (running) {
+    if (curl_multi_perform(multi, &running) != CURLM_OK) {
+      res = CURLE_OUT_OF_MEMORY;
+      break;
+    }
+    if (!running) {
+      int msgs;
+      CURLMsg *msg = curl_multi_info_read(multi, &msgs);
+      if (msg != NULL && msg->msg == CURLMSG_DONE) {
+        res = msg->data.result;
+      }
+      break;
+    }
+    int wait_msec = TTFB_POLL_MAX_MSEC;
+    if (!headers_received_) {
+      long msec = ElapsedMsec();
+      if (msec >= options_.ttfb_timeout_msec) {
+        ttfb_timed_out_ = true;
+        res = CURLE_OPERATION_TIMEDOUT;
+        break;
+      }
+      wait_msec = std::min<long>(wait_msec, options_.ttfb_timeout_msec - msec);
+    }
+    curl_multi_poll(multi, NULL, 0, wait_msec, NULL);
+  }
+  curl_multi_remove_handle(multi, curl_);
+  curl_multi_cleanup(multi);
+  return res;
+}
+
+ReqOutcome HttpReq::ClassifyResult(CURLcode res)
+{
+  double connect_time = 0;
+
+  if (ttfb_timed_out_) {
+    return REQ_TTFB_TIMEOUT;
+  }
+  switch (res) {
+  case CURLE_OK:
+    return REQ_OK;
+  case CURLE_WRITE_ERROR:
+    if (cancelled_) {
+      return REQ_CANCELLED;
+    }
+    return truncated_ ? REQ_TRUNCATED : REQ_OTHER_ERROR;
+  case CURLE_HTTP_RETURNED_ERROR:
+    return REQ_HTTP_ERROR;
+  case CURLE_COULDNT_RESOLVE_HOST:
+  case CURLE_COULDNT_RESOLVE_PROXY:
+    return REQ_DNS_ERROR;
+  case CURLE_COULDNT_CONNECT:
+    return REQ_CONNECT_ERROR;
+  case CURLE_OPERATION_TIMEDOUT:
+    curl_easy_getinfo(curl_, CURLINFO_CONNECT_TIME, &connect_time);
+    if (connect_time == 0) {
+      return REQ_CONNECT_TIMEOUT;
+    }
+    // curl reports the low speed abort with the same code
+    if (options_.low_speed_limit > 0 && strstr(curl_error_buffer_, "too slow")) {
+      return REQ_LOW_SPEED;
+    }
+    return REQ_TIMEOUT;
+  case CURLE_ABORTED_BY_CALLBACK:
+    return REQ_CANCELLED;
+  case CURLE_SSL_CONNECT_ERROR:
+  case CURLE_PEER_FAILED_VERIFICATION:
+  case CURLE_SSL_CERTPROBLEM:
+  case CURLE_SSL_CIPHER:
+  case CURLE_SSL_CACERT_BADFILE:
+  case CURLE_SSL_ISSUER_ERROR:
+  case CURLE_SSL_PINNEDPUBKEYNOTMATCH:
+  case CURLE_SSL_INVALIDCERTSTATUS:
+  case CURLE_SSL_SHUTDOWN_FAILED:
+    return REQ_TLS_ERROR;
+  case CURLE_SEND_ERROR:
+  case CURLE_RECV_ERROR:
+  case CURLE_GOT_NOTHING:
+  case CURLE_PARTIAL_FILE:
+    return REQ_RESET;
+  default:
+    return REQ_OTHER_ERROR;
+  }
+}
+
+void HttpReq::CaptureTlsInfo()
+{
+  struct curl_tlssessioninfo *session = NULL;
+
+  if (tls_captured_) {
+    return;
+  }
+  tls_captured_ = true;
+  if (curl_easy_getinfo(curl_, CURLINFO_TLS_SSL_PTR, &session) != CURLE_OK ||
+      session == NULL ||
+      session->backend != CURLSSLBACKEND_OPENSSL ||
+      session->internals == NULL) {
+    return;
+  }
+  SSL *ssl = (SSL *)session->internals;
+  tls_info_.resumed = SSL_session_reused(ssl);
+  tls_info_.protocol = SSL_get_version(ssl);
+  tls_info_.cipher = SSL_get_cipher_name(ssl);
+}
+
+curl_socket_t HttpReq::ActiveSocket()
+{
+  curl_socket_t fd = CURL_SOCKET_BAD;
+
+  if (socket_ != CURL_SOCKET_BAD) {
+    return socket_;
+  }
+  // a pooled connection was opened by an earlier request
+  if (options_.keep_alive) {
+    curl_easy_getinfo(curl_, CURLINFO_ACTIVESOCKET, &fd);
+  }
+  return fd;
+}
+
+void HttpReq::CaptureTcpInfo()
+{
+  curl_socket_t fd = ActiveSocket();
+
+  if (tcp_captured_ || fd == CURL_SOCKET_BAD) {
+    return;
+  }
+  tcp_captured_ = true;
+  ReportTcpInfo(fd);
+}
+
+void HttpReq::ReportTcpInfo(int fd)
+{
+  struct tcp_info info;
+  socklen_t len = sizeof(info);
+
+  memset(&info, 0, sizeof(info));
+  if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) {
+    log_info("failed to read TCP_INFO errno=%d", errno);
+    return;
+  }
+
+  TcpInfo tcp;
+  tcp.rtt_usec = info.tcpi_rtt;
+  tcp.rttvar_usec = info.tcpi_rttvar;
+  tcp.snd_cwnd = info.tcpi_snd_cwnd;
+  tcp.total_retrans = info.tcpi_total_retrans;
+  tcp.delivery_rate = 0;
+  if (len >= offsetof(struct tcp_info, tcpi_delivery_rate) + sizeof(info.tcpi_delivery_rate)) {
+    tcp.delivery_rate = info.tcpi_delivery_rate;
+  }
+  events_->OnTcpInfo(tcp);
+}
+
+long HttpReq::ElapsedMsec() const
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return (now.tv_sec - start_time_.tv_sec) * 1000 +
+    (now.tv_usec - start_time_.tv_usec) / 1000;
+}
+
+// curl cannot enforce its deadlines while the debug callback blocks, the
+// wait ends at the nearest one and curl then fails the request itself
+long HttpReq::RxTimestampWaitMsec() const
+{
+  long wait_msec = RX_TIMESTAMP_WAIT_MSEC;
+  long elapsed = ElapsedMsec();
+
+  if (options_.timeout_msec > 0) {
+    wait_msec = std::min(wait_msec, options_.timeout_msec - elapsed);
+  }
+  if (options_.ttfb_timeout_msec > 0) {
+    wait_msec = std::min(wait_msec, options_.ttfb_timeout_msec - elapsed);
+  }
+  if (options_.low_speed_limit > 0) {
+    wait_msec = std::min(wait_msec, options_.low_speed_time * 1000);
+  }
+  return std::max(wait_msec, 0L);
+}
+
+void HttpReq::PeekKernelRxTimestamp()
+{
+  struct pollfd pfd;
+  struct timeval sent_time;
+  struct timeval wakeup_time;
+  char data;
+  char control[CMSG_SPACE(sizeof(struct scm_timestamping))];
+  struct iovec iov;
+  struct msghdr msg;
+  curl_socket_t fd = ActiveSocket();
+
+  if (!options_.kernel_timestamps || rx_timestamp_peeked_ ||
+      fd == CURL_SOCKET_BAD) {
+    return;
+  }
+  rx_timestamp_peeked_ = true;
+
+  // wait for the first response bytes ourselves so the kernel timestamp of
+  // the head of the receive queue can be read before curl consumes it
+  gettimeofday(&sent_time, NULL);
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  long wait_msec = RxTimestampWaitMsec();
+  int ready = 0;
+  while (ready == 0 && wait_msec > 0) {
+    if (events_ && events_->IsCancelled()) {
+      return;
+    }
+    int slice = std::min(wait_msec, (long)RX_TIMESTAMP_POLL_MSEC);
+    ready = poll(&pfd, 1, slice);
+    wait_msec -= slice;
+  }
+  if (ready <= 0) {
+    return;
+  }
+  gettimeofday(&wakeup_time, NULL);
+
+  iov.iov_base = &data;
+  iov.iov_len = sizeof(data);
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  if (recvmsg(fd, &msg, MSG_PEEK | MSG_DONTWAIT) <= 0) {
+    return;
+  }
+
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPING) {
+      continue;
+    }
+    struct scm_timestamping ts;
+    memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+    struct timeval kernel_time;
+    kernel_time.tv_sec = ts.ts[0].tv_sec;
+    kernel_time.tv_usec = ts.ts[0].tv_nsec / 1000;
+    // bytes queued before the request went out (e.g. TLS session tickets)
+    // are not the response
+    if (timercmp(&kernel_time, &sent_time, <)) {
+      log_info("queued data predates the request, no rx timestamp");
+      return;
+    }
+    events_->OnKernelRxTimestamp(kernel_time, wakeup_time);
+    return;
+  }
+}
+
+void HttpReq::ReportTlsInfo()
+{
+  curl_off_t connect_usec = 0;
+  curl_off_t appconnect_usec = 0;
+
+  curl_easy_getinfo(curl_, CURLINFO_CONNECT_TIME_T, &connect_usec);
+  curl_easy_getinfo(curl_, CURLINFO_APPCONNECT_TIME_T, &appconnect_usec);
+  if (tls_info_.protocol == NULL || appconnect_usec == 0) {
+    return;
+  }
+  tls_info_.handshake_usec = appconnect_usec - connect_usec;
+  events_->OnTlsHandshake(tls_info_);
 }
 
 void HttpReq::PerformGet()
 {
+  if (options_.engine == HTTP_ENGINE_RAW) {
+    RawPerformGet();
+    return;
+  }
+  curl_ = curl_easy_init();
   SetCurlHeaders();
   SetCurlOptions();
   InvokeCurl();
 }
 
 
+int HttpReq::CurlSockoptCallback(curl_socket_t fd)
+{
+  int i = 1;
+  if(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &i, sizeof(i)))
+    return CURL_SOCKOPT_ERROR;
+  if (options_.rcvbuf > 0) {
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &options_.rcvbuf, sizeof(options_.rcvbuf))) {
+      log_warn("failed to set SO_RCVBUF errno=%d", errno);
+    }
+  }
+  if (options_.busy_poll_usec > 0) {
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &options_.busy_poll_usec,
+                   sizeof(options_.busy_poll_usec))) {
+      log_warn("failed to set SO_BUSY_POLL errno=%d", errno);
+    }
+  }
+  if (options_.kernel_timestamps) {
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags))) {
+      log_warn("failed to enable SO_TIMESTAMPING errno=%d", errno);
+    }
+  }
+  // a redirect may open a new connection, the statistics follow the last one
+  socket_ = fd;
+  tcp_captured_ = false;
+  rx_timestamp_peeked_ = false;
+  return CURL_SOCKOPT_OK;
+}
+
+int HttpReq::CurlCloseSocketCallback(curl_socket_t fd)
+{
+  // the connection is going away (e.g. 'Connection: close'), read it now
+  if (fd == socket_) {
+    CaptureTcpInfo();
+    socket_ = CURL_SOCKET_BAD;
+  }
+  return close(fd);
+}
+
 size_t HttpReq::CurlReadCallback(char *data, size_t size)
 {
   return size;
@@ -181,11 +685,16 @@ size_t HttpReq::CurlReadCallback(char *data, size_t size)
 size_t HttpReq::CurlWriteCallback(char *data, size_t size)
 {
   if (events_) {
+    if (events_->IsCancelled()) {
+      cancelled_ = true;
+      return 0;
+    }
     events_->OnReqRecvData(size);
   }
   recv_size_ += size;
   if (recv_limit_ > 0 && recv_size_ > recv_limit_) {
-    return CURLE_WRITE_ERROR;
+    truncated_ = true;
+    return 0;
   }
   return size;
 }
@@ -193,8 +702,11 @@ size_t HttpReq::CurlWriteCallback(char *data, size_t size)
 int HttpReq::CurlProgressCallback(double download_total, double download_now,
                                   double upload_total, double upload_now)
 {
-  log_info("download_total=%.2f, download_now=%.2f, upload_total=%.2f, upload_now=%.2f",
-           download_total, download_now, upload_total, upload_now);
+  log_debug("download_total=%.2f, download_now=%.2f, upload_total=%.2f, upload_now=%.2f",
+            download_total, download_now, upload_total, upload_now);
+  if (events_ && events_->IsCancelled()) {
+    return 1;
+  }
   return 0;
 }
 
@@ -207,11 +719,14 @@ int HttpReq::CurlDebugCallback(CURL *curl,
     break;
   case CURLINFO_HEADER_IN:
     log_info("CURLINFO_HEADER_IN buf=%s, len=%ld", buf, len);
+    headers_received_ = true;
     events_->OnReqRecvHeaders();
     break;
   case CURLINFO_HEADER_OUT:
     log_info("CURLINFO_HEADER_OUT buf=%s, len=%ld", buf, len);
+    CaptureTlsInfo();
     events_->OnReqSendHeaders();
+    PeekKernelRxTimestamp();
     break;
   case CURLINFO_DATA_IN:
     // log_info("CURLINFO_DATA_IN buf=%p, len=%ld", buf, len);
@@ -264,16 +779,90 @@ int HttpReq::Init()
   /* Init curl */
   curl_global_init(CURL_GLOBAL_ALL);
 
+  /* share tls sessions between requests so resumed handshakes are measured */
+  for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+    pthread_mutex_init(&curl_share_locks[i], NULL);
+  }
+  return ResetConnections();
+
+}
+
+static CURLSH *NewCurlShare()
+{
+  CURLSH *share = curl_share_init();
+  if (share == NULL) {
+    return NULL;
+  }
+  curl_share_setopt(share, CURLSHOPT_LOCKFUNC, curl_share_lock_callback);
+  curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, curl_share_unlock_callback);
+  curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+  return share;
+}
+
+static void FreeCurlShares()
+{
+  if (curl_share != NULL) {
+    curl_share_cleanup(curl_share);
+    curl_share = NULL;
+  }
+}
+
+/* static */
+int HttpReq::ResetConnections()
+{
+  // drops pooled connections and tls sessions, no request may be running
+  RawHttpClient::ResetConnections();
+  curl_generation_g++;
+  FreeCurlShares();
+  curl_share = NewCurlShare();
+  if (curl_share == NULL) {
+    log_error("Failed to allocate curl share handle");
+    FreeCurlShares();
+    return RET_FAIL;
+  }
   return RET_OK;
+}
+
+/* static */
+int HttpReq::LoadCaStore(const string &ca_file)
+{
+  ca_store = X509_STORE_new();
+  if (ca_store == NULL) {
+    log_error("Failed to allocate CA store");
+    return RET_FAIL;
+  }
 
+  int ret;
+  if (ca_file.empty()) {
+    ret = X509_STORE_set_default_paths(ca_store);
+  }
+  else {
+    ret = X509_STORE_load_locations(ca_store, ca_file.c_str(), NULL);
+  }
+  if (ret != 1) {
+    log_error("Failed to load CA store '%s'", ca_file.c_str());
+    X509_STORE_free(ca_store);
+    ca_store = NULL;
+    return RET_FAIL;
+  }
+  return RET_OK;
 }
 
 /* static */
 void HttpReq::Fini()
 {
   /* Clean curl */
+  FreeCurlShares();
+  for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+    pthread_mutex_destroy(&curl_share_locks[i]);
+  }
   curl_global_cleanup();
 
+  if (ca_store != NULL) {
+    X509_STORE_free(ca_store);
+    ca_store = NULL;
+  }
+
   /* Clean openssl */
   CRYPTO_set_locking_callback(NULL);
   CRYPTO_set_id_callback(NULL);
@@ -3,18 +3,98 @@
 
 #include <string>
 #include <vector>
+#include <sys/time.h>
 #include <curl/curl.h>
 
 using std::string;
 using std::vector;
 
+struct TlsInfo
+{
+  uint64_t handshake_usec;
+  bool resumed;
+  const char *protocol;
+  const char *cipher;
+};
+
+struct TcpInfo
+{
+  uint32_t rtt_usec;
+  uint32_t rttvar_usec;
+  uint32_t snd_cwnd;
+  uint32_t total_retrans;
+  uint64_t delivery_rate;
+};
+
+// how a request ended
+enum ReqOutcome {
+  REQ_OK = 0,
+  REQ_TRUNCATED,        // stopped on purpose at the data limit
+  REQ_HTTP_ERROR,
+  REQ_DNS_ERROR,
+  REQ_CONNECT_ERROR,
+  REQ_CONNECT_TIMEOUT,
+  REQ_TLS_ERROR,
+  REQ_RESET,
+  REQ_TTFB_TIMEOUT,
+  REQ_LOW_SPEED,
+  REQ_TIMEOUT,
+  REQ_CANCELLED,
+  REQ_OTHER_ERROR,
+  REQ_OUTCOMES
+};
+
+const char *ReqOutcomeName(int outcome);
+
+enum HttpEngine {
+  HTTP_ENGINE_CURL = 0,
+  // plain http GET client on epoll, see http_raw.h
+  HTTP_ENGINE_RAW
+};
+
+class RawHttpClient;
+class RawHttpParser;
+
+struct HttpReqOptions
+{
+  HttpReqOptions();
+  // enable SO_TIMESTAMPING and peek the kernel receive time of the
+  // first response bytes, forces HTTP/1.1
+  bool kernel_timestamps;
+  // CURLOPT_BUFFERSIZE and SO_RCVBUF, 0 keeps the defaults
+  long buffer_size;
+  int rcvbuf;
+  // reuse connections from a process wide pool instead of a new
+  // connection per request
+  bool keep_alive;
+  // deadlines, 0 disables: connect, first response byte since the start
+  // of the request, whole request, and abort when slower than
+  // low_speed_limit bytes/sec for low_speed_time sec
+  long connect_timeout_msec;
+  long ttfb_timeout_msec;
+  long timeout_msec;
+  long low_speed_limit;
+  long low_speed_time;
+  HttpEngine engine;
+  // SO_BUSY_POLL, spin up to busy_poll_usec in blocking receives instead
+  // of sleeping until the interrupt, 0 keeps the default
+  int busy_poll_usec;
+};
+
 class HttpReqEvents
 {
 public:
+  virtual void OnReqStart() = 0;
   virtual void OnReqSendHeaders() = 0;
   virtual void OnReqRecvHeaders() = 0;
   virtual void OnReqRecvData(size_t size) = 0;
-  virtual void OnComplete(unsigned long http_code) = 0;
+  virtual void OnTlsHandshake(const TlsInfo &info) = 0;
+  virtual void OnTcpInfo(const TcpInfo &info) = 0;
+  virtual void OnKernelRxTimestamp(const struct timeval &kernel_time,
+                                   const struct timeval &wakeup_time) = 0;
+  virtual void OnComplete(unsigned long http_code, ReqOutcome outcome) = 0;
+  // polled during the transfer, true aborts the request
+  virtual bool IsCancelled() = 0;
 };
 
 class HttpReq
@@ -26,6 +106,7 @@ public:
   void AddHeader(const string& header);
   void AddHeader(const string& name, const string& value);
   void AddGetRangeHeader(uint64_t start, uint64_t end);
+  void SetOptions(const HttpReqOptions &options);
   void ReportEvents(HttpReqEvents *events);
   void PerformGet();
 
@@ -34,21 +115,51 @@ public:
   int CurlProgressCallback(double download_total, double download_now,
                            double upload_total, double upload_now);
   int CurlDebugCallback(CURL *curl, curl_infotype infotype, char *buf, size_t len);
+  int CurlSockoptCallback(curl_socket_t fd);
+  int CurlCloseSocketCallback(curl_socket_t fd);
 
   static int Init();
+  static int LoadCaStore(const string &ca_file);
+  static int ResetConnections();
   static void Fini();
 
   void SetCurlOptions();
   void SetCurlHeaders();
   void SetDataLimit(size_t len);
   void InvokeCurl();
+  CURLcode PerformWithTtfbTimeout();
+  ReqOutcome ClassifyResult(CURLcode res);
+  void CaptureTlsInfo();
+  void ReportTlsInfo();
+  void CaptureTcpInfo();
+  void ReportTcpInfo(int fd);
+  curl_socket_t ActiveSocket();
+  void PeekKernelRxTimestamp();
+  long RxTimestampWaitMsec() const;
+  long ElapsedMsec() const;
 
 private:
+  void RawPerformGet();
+  ReqOutcome RawExchange(RawHttpClient *client, int fd, size_t request_len,
+                         bool connecting, RawHttpParser *parser, bool *stale);
+  ReqOutcome RawCheckDeadlines(bool connecting, int *wait_msec);
+
   string url_;
   vector<string> headers_;
   HttpReqEvents *events_;
+  HttpReqOptions options_;
   size_t recv_limit_;
   size_t recv_size_;
+  bool tls_captured_;
+  TlsInfo tls_info_;
+  curl_socket_t socket_;
+  bool tcp_captured_;
+  bool rx_timestamp_peeked_;
+  struct timeval start_time_;
+  bool headers_received_;
+  bool truncated_;
+  bool cancelled_;
+  bool ttfb_timed_out_;
 
   // curl
   CURL* curl_;
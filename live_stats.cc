@@ -0,0 +1,64 @@
+#include <thread>
+
+#include "live_stats.h"
+#include "stat_gen.h"
+
+IntervalStats::IntervalStats()
+{
+  Reset();
+}
+
+void IntervalStats::Reset()
+{
+  requests = 0;
+  successes = 0;
+  bytes = 0;
+  time_usec.Reset();
+}
+
+void IntervalStats::Add(const Statistics &stat)
+{
+  requests++;
+  if (stat.IsSuccess()) {
+    successes++;
+  }
+  bytes += stat.get_data_size();
+  time_usec.Record(Statistics::Usec(stat.GetTotalTime()));
+}
+
+void IntervalStats::Merge(const IntervalStats &other)
+{
+  requests += other.requests;
+  successes += other.successes;
+  bytes += other.bytes;
+  time_usec.Merge(other.time_usec);
+}
+
+LiveStats::LiveStats():
+  active_(0), writing_(0)
+{
+}
+
+void LiveStats::Add(const Statistics &stat)
+{
+  // announce the buffer before writing and make sure it is still the
+  // active one, a reader that swapped in between waits for writing_
+  int idx;
+  do {
+    idx = active_.load();
+    writing_.store(idx + 1);
+  } while (active_.load() != idx);
+  buffers_[idx].Add(stat);
+  writing_.store(0);
+}
+
+void LiveStats::Drain(IntervalStats *interval)
+{
+  int idx = active_.load();
+  active_.store(1 - idx);
+  while (writing_.load() == idx + 1) {
+    std::this_thread::yield();
+  }
+  interval->Merge(buffers_[idx]);
+  buffers_[idx].Reset();
+}
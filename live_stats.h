@@ -0,0 +1,47 @@
+#ifndef _LIVE_STATS_H_
+#define _LIVE_STATS_H_
+
+#include <stdint.h>
+#include <atomic>
+
+#include "histogram.h"
+
+class Statistics;
+
+// Totals of the requests completed in a reporting interval
+struct IntervalStats
+{
+  IntervalStats();
+  void Reset();
+  void Add(const Statistics &stat);
+  void Merge(const IntervalStats &other);
+
+  uint64_t requests;
+  uint64_t successes;
+  uint64_t bytes;
+  Histogram time_usec;
+};
+
+// Statistics of one worker for the running interval. Double buffered: the
+// worker records into the active buffer while a reader swaps the buffers
+// and drains the inactive one. The worker never waits for the reader, the
+// reader waits at most for one Add() to finish. There must be only one
+// reader at a time.
+class LiveStats
+{
+public:
+  LiveStats();
+  // worker thread
+  void Add(const Statistics &stat);
+  // reader thread: merges the interval recorded since the last call into
+  // 'interval'
+  void Drain(IntervalStats *interval);
+
+private:
+  IntervalStats buffers_[2];
+  std::atomic<int> active_;
+  // index + 1 of the buffer Add() is writing to, 0 when idle
+  std::atomic<int> writing_;
+};
+
+#endif /* _LIVE_STATS_H_ */
@@ -6,6 +6,11 @@
 #include <boost/program_options.hpp>
 
 #include "stat_gen.h"
+#include "param_sweep.h"
+#include "concurrency_search.h"
+#include "stat_file.h"
+#include "baseline.h"
+#include "aggregator.h"
 #include "logging.h"
 #include "errors.h"
 
@@ -14,6 +19,9 @@ using std::vector;
 using std::string;
 using std::cout;
 
+// rounds --precision runs at most when neither -n nor -t is given
+static const int PRECISION_MAX_ROUNDS = 10000;
+
 static void Help(const po::options_description &opts)
 {
   cout << "Usage:\n";
@@ -32,9 +40,119 @@ static void ParseProgramOptions(int argc, char **argv, po::variables_map *vm)
     ("count,n", po::value<int>(), "Send 'count' requests. Supercedes -t.")
     ("range,r", po::value<string>()->default_value(":"), "Specify range [start, end) of the request data 0:1024, 100:, :1024")
     ("length,l", po::value<size_t>()->default_value(0), "Limit received data to 'length' bytes'")
+    ("concurrency,c", po::value<int>()->default_value(1),
+     "Run 'concurrency' workers with a request in flight each.")
+    ("buffer-size", po::value<long>(), "Receive buffer size of curl (CURLOPT_BUFFERSIZE).")
+    ("rcvbuf", po::value<int>(), "Socket receive buffer size (SO_RCVBUF).")
+    ("keep-alive", "Reuse connections between requests.")
+    ("engine", po::value<string>()->default_value("curl"),
+     "Send requests with 'curl' or 'raw', a minimal non-blocking HTTP/1.1 client "
+     "on epoll with less per-request overhead. raw fetches plain http only and "
+     "does not follow redirects.")
+    ("sweep", po::value<vector<string>>(),
+     "Sweep a parameter 'name=v1,v2,...', may be repeated to run the cross-product. "
+     "Names: concurrency, buffer, rcvbuf, range (size), keepalive (0/1). "
+     "Each cell runs -n rounds per worker after --warmup rounds, without -i waits.")
+    ("warmup", po::value<int>()->default_value(1),
+     "Rounds run and discarded before each sweep cell or --find-knee step.")
+    ("objective", po::value<string>()->default_value("throughput"),
+     "Rank sweep cells by throughput, reqsec, p50, p90 or p99.")
+    ("find-knee", po::value<int>(),
+     "Ramp the concurrency up to 'find-knee' workers (doubling, or by --knee-step), "
+     "-n rounds per worker at each step, and report where throughput plateaus or p99 "
+     "breaks --slo.")
+    ("knee-step", po::value<int>()->default_value(0), "Add 'knee-step' workers per step instead of doubling.")
+    ("slo", po::value<double>()->default_value(0), "p99 latency SLO in msec for --find-knee.")
+    ("plateau", po::value<double>()->default_value(5),
+     "Throughput gain in percent below which --find-knee considers the throughput plateaued.")
+    ("detect-warmup", "Detect the warm-up requests (MSER-5 on the latency series) "
+                      "and exclude them from the summary.")
+    ("precision", po::value<string>(),
+     "Keep sampling until the 95% confidence interval of the --precision-percentile "
+     "latency is narrower than 'precision' msec, or percent of the estimate with a "
+     "trailing '%'. -n caps the number of rounds, 10000 without -n or -t.")
+    ("precision-percentile", po::value<double>()->default_value(50),
+     "Latency percentile the --precision interval is computed for.")
+    ("size-sweep", po::value<string>(),
+     "Sweep range sizes 'min:max[:factor]' (geometric, factor 2 by default) on the same "
+     "object, -n rounds in random order, and fit latency = overhead + size / bandwidth.")
+    ("save-baseline", po::value<string>(), "Save the run's histograms and samples to a baseline file.")
+    ("baseline", po::value<string>(),
+     "Compare the run against a baseline file and exit with status 2 if latency or "
+     "throughput regressed.")
+    ("regression-threshold", po::value<double>()->default_value(10),
+     "Percentile increase or throughput drop in percent counted as a regression.")
+    ("alpha", po::value<double>()->default_value(0.05),
+     "Significance level of the Mann-Whitney test a latency regression must pass.")
+    ("report-to", po::value<string>(),
+     "Send the run's histograms and counters to a --collect aggregator on this unix "
+     "socket, with the samples only if another option keeps them.")
+    ("aggregate", po::value<vector<string>>()->multitoken(),
+     "Merge the files saved by several processes with --save-baseline into one report "
+     "instead of running requests.")
+    ("collect", po::value<string>(),
+     "Merge the reports --processes processes send with --report-to to this unix socket "
+     "into one report instead of running requests.")
+    ("processes", po::value<int>()->default_value(1), "Number of reports --collect waits for.")
     ("interval,i", po::value<int>(), "Wait 'interval' seconds between each request. "
                                      "There is a 1-second wait if this option is not specified.")
+    ("report-interval", po::value<int>(),
+     "Print the throughput and latency percentiles of every 'report-interval' seconds "
+     "while the run continues.")
+    ("heatmap", po::value<string>(),
+     "Write the latency histogram of every --heatmap-window of the run to this file "
+     "and draw it as a heatmap in the summary.")
+    ("heatmap-window", po::value<double>()->default_value(1),
+     "Seconds per heatmap window. Long runs merge neighbouring windows to keep at "
+     "most 4096.")
+    ("exact-percentiles", "Keep every request in memory, about 40 bytes each, and add "
+                          "exact latency percentiles of each phase to the summary.")
+    ("samples", po::value<string>(),
+     "Write every request's start, target, status, size and phase times to this file. "
+     "Implies --exact-percentiles.")
+    ("shm", po::value<string>(),
+     "Publish live counters and latency histograms in the shared memory segment "
+     "'/shm', watch them with 'cloud-ping-top shm'.")
+    ("metrics", po::value<string>(),
+     "Serve Prometheus metrics on http://[addr:]port/metrics, the address is "
+     "127.0.0.1 by default.")
+    ("cpu-accounting", "Report the CPU time, context switches, page faults and, if "
+                       "perf_event_open is allowed, cycles of each worker per request and per MB.")
+    ("pin", po::value<string>(),
+     "Pin each worker thread to one core: 'compact' fills the cores of a NUMA node "
+     "before the next, 'spread' deals workers round robin across nodes. Workers "
+     "allocate their statistics on their own node. The summary lists the cores "
+     "every worker ran on.")
+    ("cpus", po::value<string>(),
+     "Cores --pin places workers on, like '0-3,8'. All cores the process may run "
+     "on by default.")
+    ("busy-poll", po::value<int>(),
+     "Busy poll the receive queue of request sockets for up to 'busy-poll' usec "
+     "(SO_BUSY_POLL) instead of sleeping until the interrupt.")
+    ("hedge", po::value<string>(),
+     "Send a second copy of a request still running after 'hedge' msec, or after the "
+     "running p95 of unhedged requests with 'p95', and cancel the slower copy. Every "
+     "other request runs unhedged for comparison.")
+    ("hedge-url", po::value<string>(), "Send the hedge copies to this url instead of the same target.")
+    ("connect-timeout", po::value<long>(), "Fail a request not connected after 'connect-timeout' msec.")
+    ("ttfb-timeout", po::value<long>(),
+     "Fail a request without response headers 'ttfb-timeout' msec after it started.")
+    ("timeout", po::value<long>(), "Fail a request not complete after 'timeout' msec.")
+    ("low-speed-limit", po::value<long>(),
+     "Fail a request slower than 'low-speed-limit' bytes/sec for --low-speed-time seconds.")
+    ("low-speed-time", po::value<long>()->default_value(10), "See --low-speed-limit.")
     ("verbose,v", "Verbose. Print detailed output. Supercedes -s.")
+    ("stall-threshold", po::value<int>()->default_value(200),
+     "Count a gap of at least 'stall-threshold' msec between received data chunks as a stall.")
+    ("ramp-bucket", po::value<int>(),
+     "Profile throughput in 'ramp-bucket' msec buckets since the first received byte "
+     "and report the ramp up to the peak rate.")
+    ("kernel-timestamps", "Read kernel receive timestamps (SO_TIMESTAMPING) of the first "
+                          "response bytes and report the delay until the client sees them. "
+                          "Only new connections are timestamped.")
+    ("verify", "Verify the TLS peer certificate. The CA store is loaded once per process.")
+    ("cacert", po::value<string>(),
+     "CA bundle used with --verify instead of the system default paths.")
     ("auth,a", po::value<string>()->default_value(""),
      "Authentication string.\n"
      "For S3 '<access-key>:<secret-key>'\n"
@@ -43,7 +161,8 @@ static void ParseProgramOptions(int argc, char **argv, po::variables_map *vm)
      "url to access\n"
      "For http: 'http://some-server.com/file1'\n"
      "For S3: 's3://test-bucket/file1'\n"
-     "For Cloud Front 'cf://dgdfdf3b.cloudfront.net/1.bin'")
+     "For Cloud Front 'cf://dgdfdf3b.cloudfront.net/1.bin'\n"
+     "Use https://, s3s:// or cfs:// to access over TLS")
     ("help,h", "Display help")
     ;
 
@@ -67,7 +186,8 @@ static void ParseProgramOptions(int argc, char **argv, po::variables_map *vm)
     Help(opts);
   }
 
-  if (vm->count("url") == 0) {
+  if (vm->count("url") == 0 && vm->count("aggregate") == 0 &&
+      vm->count("collect") == 0) {
     cout << "Missing url parameter\n";
     Help(opts);
   }
@@ -92,6 +212,74 @@ static void ParseRange(const string& range,
   }
 }
 
+static bool ParseSizeSweep(const string& sweep,
+                           uint64_t *min_size,
+                           uint64_t *max_size,
+                           double *factor)
+{
+  *factor = 2;
+  auto first = sweep.find(":");
+  if (first == string::npos) {
+    return false;
+  }
+  auto second = sweep.find(":", first+1);
+  *min_size = stoll(sweep.substr(0, first));
+  *max_size = stoll(sweep.substr(first+1, second - (first+1)));
+  if (second != string::npos) {
+    *factor = stod(sweep.substr(second+1));
+  }
+  return *min_size > 0 && *min_size <= *max_size && *factor > 1;
+}
+
+// saves, sends and compares the reports of a run or an aggregation,
+// returns the process exit status
+static int FinishReports(const po::variables_map &vm,
+                         const vector<StatReport> &reports,
+                         uint64_t elapsed_usec)
+{
+  if (vm.count("save-baseline") != 0 &&
+      StatFile::Save(vm["save-baseline"].as<string>(), reports,
+                     elapsed_usec) != RET_OK) {
+    return 1;
+  }
+  if (vm.count("report-to") != 0 &&
+      StatFile::Send(vm["report-to"].as<string>(), reports,
+                     elapsed_usec) != RET_OK) {
+    return 1;
+  }
+  if (vm.count("baseline") != 0) {
+    Baseline baseline(vm["regression-threshold"].as<double>(),
+                      vm["alpha"].as<double>());
+    if (baseline.Load(vm["baseline"].as<string>()) != RET_OK) {
+      return 1;
+    }
+    if (baseline.Compare(reports)) {
+      return RET_REGRESSION;
+    }
+  }
+  return 0;
+}
+
+static int Aggregate(const po::variables_map &vm)
+{
+  Aggregator aggregator;
+  if (vm.count("aggregate") != 0) {
+    for (auto path: vm["aggregate"].as<vector<string>>()) {
+      if (aggregator.AddFile(path) != RET_OK) {
+        return 1;
+      }
+    }
+  }
+  if (vm.count("collect") != 0 &&
+      aggregator.Collect(vm["collect"].as<string>(),
+                         vm["processes"].as<int>()) != RET_OK) {
+    return 1;
+  }
+  aggregator.Dump();
+  return FinishReports(vm, aggregator.get_reports(),
+                       aggregator.get_elapsed_usec());
+}
+
 int main(int argc, char *argv[])
 {
   po::variables_map vm;
@@ -125,19 +313,226 @@ int main(int argc, char *argv[])
              &range_start,
              &range_end);
 
+  int stall_threshold = vm["stall-threshold"].as<int>();
+  if (stall_threshold <= 0) {
+    cout << "Invalid stall threshold '" << stall_threshold << "'\n";
+    return 1;
+  }
+  Statistics::set_stall_threshold_usec(stall_threshold * 1000ULL);
+
+  if (vm.count("ramp-bucket") != 0) {
+    Statistics::set_ramp_bucket_usec(vm["ramp-bucket"].as<int>() * 1000);
+  }
+
+  HttpReqOptions req_options;
+  if (vm.count("kernel-timestamps") != 0) {
+    req_options.kernel_timestamps = true;
+  }
+  if (vm.count("buffer-size") != 0) {
+    req_options.buffer_size = vm["buffer-size"].as<long>();
+  }
+  if (vm.count("rcvbuf") != 0) {
+    req_options.rcvbuf = vm["rcvbuf"].as<int>();
+  }
+  if (vm.count("keep-alive") != 0) {
+    req_options.keep_alive = true;
+  }
+  if (vm.count("connect-timeout") != 0) {
+    req_options.connect_timeout_msec = vm["connect-timeout"].as<long>();
+  }
+  if (vm.count("ttfb-timeout") != 0) {
+    req_options.ttfb_timeout_msec = vm["ttfb-timeout"].as<long>();
+  }
+  if (vm.count("timeout") != 0) {
+    req_options.timeout_msec = vm["timeout"].as<long>();
+  }
+  if (vm.count("low-speed-limit") != 0) {
+    req_options.low_speed_limit = vm["low-speed-limit"].as<long>();
+    req_options.low_speed_time = vm["low-speed-time"].as<long>();
+  }
+  if (vm.count("busy-poll") != 0) {
+    req_options.busy_poll_usec = vm["busy-poll"].as<int>();
+  }
+  string engine = vm["engine"].as<string>();
+  if (engine == "raw") {
+    req_options.engine = HTTP_ENGINE_RAW;
+  }
+  else if (engine != "curl") {
+    cout << "Invalid engine '" << engine << "'\n";
+    return 1;
+  }
+  if (req_options.engine == HTTP_ENGINE_RAW) {
+    // --aggregate and --collect run without a url
+    vector<string> urls;
+    if (vm.count("url") != 0) {
+      urls = vm["url"].as<vector<string>>();
+    }
+    if (vm.count("hedge-url") != 0) {
+      urls.push_back(vm["hedge-url"].as<string>());
+    }
+    for (auto url: urls) {
+      // https://, s3s:// and cfs:// are the TLS schemes
+      string scheme = url.substr(0, url.find("://"));
+      if (!scheme.empty() && scheme.back() == 's') {
+        cout << "The raw engine does not support TLS, '" << url << "'\n";
+        return 1;
+      }
+    }
+    if (req_options.kernel_timestamps) {
+      cout << "--kernel-timestamps needs the curl engine\n";
+      return 1;
+    }
+  }
+
   StatGenerator gen;
+  if (vm.count("detect-warmup") != 0) {
+    StatReport::set_retain_samples(true);
+    gen.SetDetectWarmup(true);
+  }
+  if (vm.count("precision") != 0) {
+    string precision = vm["precision"].as<string>();
+    bool relative = !precision.empty() && precision.back() == '%';
+    StatReport::SetPrecision(vm["precision-percentile"].as<double>(),
+                             stod(precision), relative);
+    StatReport::set_retain_samples(true);
+    gen.SetPrecision(true);
+    if (vm.count("count") == 0 && !repeat) {
+      count = PRECISION_MAX_ROUNDS;
+    }
+  }
+  if (vm.count("aggregate") != 0 || vm.count("collect") != 0) {
+    return Aggregate(vm);
+  }
+
+  if (vm.count("save-baseline") != 0 || vm.count("baseline") != 0) {
+    StatReport::set_retain_samples(true);
+  }
+  if (vm.count("cpu-accounting") != 0) {
+    gen.SetCpuAccounting(true);
+  }
+  if (vm.count("pin") != 0 || vm.count("cpus") != 0) {
+    string pin = vm.count("pin") != 0 ? vm["pin"].as<string>() : "compact";
+    string cpus = vm.count("cpus") != 0 ? vm["cpus"].as<string>() : "";
+    if ((pin != "compact" && pin != "spread") ||
+        gen.SetPlacement(pin == "compact" ? CpuPlacement::COMPACT :
+                         CpuPlacement::SPREAD, cpus) != RET_OK) {
+      cout << "Invalid placement '" << pin << "' on cpus '" << cpus << "'\n";
+      return 1;
+    }
+  }
+  if (vm.count("heatmap") != 0) {
+    gen.SetHeatmap(vm["heatmap"].as<string>(),
+                   vm["heatmap-window"].as<double>() * 1000000);
+  }
+  if (vm.count("exact-percentiles") != 0 || vm.count("samples") != 0) {
+    StatReport::set_retain_samples(true);
+    gen.SetExactPercentiles(vm.count("samples") != 0 ? vm["samples"].as<string>() : "");
+  }
+  if (vm.count("report-interval") != 0) {
+    gen.SetReportInterval(vm["report-interval"].as<int>() * 1000000ULL);
+  }
+  gen.SetReqOptions(req_options);
+  gen.SetConcurrency(std::max(vm["concurrency"].as<int>(), 1));
   string auth = vm["auth"].as<string>();
   for (auto url: vm["url"].as<vector<string>>()) {
     gen.AddConnection(url, auth, range_start, range_end,
                       vm["length"].as<size_t>());
   }
 
+  if (vm.count("hedge") != 0) {
+    string hedge = vm["hedge"].as<string>();
+    uint64_t delay_usec = hedge == "p95" ? 0 : stod(hedge) * 1000;
+    string hedge_url;
+    if (vm.count("hedge-url") != 0) {
+      hedge_url = vm["hedge-url"].as<string>();
+    }
+    if ((hedge != "p95" && delay_usec == 0) ||
+        gen.SetHedge(delay_usec, hedge_url, auth, range_start, range_end,
+                     vm["length"].as<size_t>()) != RET_OK) {
+      cout << "Invalid hedge '" << hedge << "'\n";
+      return 1;
+    }
+  }
+
+  if (vm.count("shm") != 0 && gen.PublishShm(vm["shm"].as<string>()) != RET_OK) {
+    log_println("Failed to create the shared memory segment");
+    return 1;
+  }
+
+  if (vm.count("metrics") != 0) {
+    string listen = vm["metrics"].as<string>();
+    string addr = "127.0.0.1";
+    auto colon = listen.rfind(":");
+    if (colon != string::npos) {
+      addr = listen.substr(0, colon);
+      listen = listen.substr(colon + 1);
+    }
+    if (gen.StartMetricsServer(addr, stoi(listen)) != RET_OK) {
+      log_println("Failed to start the metrics server");
+      return 1;
+    }
+  }
+
   if (HttpReq::Init() != RET_OK) {
     log_error("Failed to initialize http request infrastructure");
     return 0;
   }
 
-  gen.Run(count, interval, repeat);
+  if (vm.count("verify") != 0) {
+    string ca_file;
+    if (vm.count("cacert") != 0) {
+      ca_file = vm["cacert"].as<string>();
+    }
+    if (HttpReq::LoadCaStore(ca_file) != RET_OK) {
+      log_println("Failed to load CA store");
+      HttpReq::Fini();
+      return 1;
+    }
+  }
+
+  if (vm.count("sweep") != 0) {
+    ParamSweep sweep(&gen);
+    for (auto spec: vm["sweep"].as<vector<string>>()) {
+      if (!sweep.AddParam(spec)) {
+        cout << "Invalid sweep parameter '" << spec << "'\n";
+        HttpReq::Fini();
+        return 1;
+      }
+    }
+    string objective = vm["objective"].as<string>();
+    if (!ParamSweep::IsValidObjective(objective)) {
+      cout << "Invalid objective '" << objective << "'\n";
+      HttpReq::Fini();
+      return 1;
+    }
+    sweep.Run(count, vm["warmup"].as<int>());
+    sweep.Dump(objective);
+  }
+  else if (vm.count("find-knee") != 0) {
+    ConcurrencySearch search(&gen, vm["find-knee"].as<int>(),
+                             vm["knee-step"].as<int>(),
+                             vm["slo"].as<double>(),
+                             vm["plateau"].as<double>());
+    search.Run(count, vm["warmup"].as<int>());
+    search.Dump();
+  }
+  else if (vm.count("size-sweep") != 0) {
+    uint64_t min_size;
+    uint64_t max_size;
+    double factor;
+    if (!ParseSizeSweep(vm["size-sweep"].as<string>(), &min_size, &max_size, &factor)) {
+      cout << "Invalid size sweep '" << vm["size-sweep"].as<string>() << "'\n";
+      HttpReq::Fini();
+      return 1;
+    }
+    gen.RunSizeSweep(min_size, max_size, factor, count, interval, repeat);
+  }
+  else {
+    gen.Run(count, interval, repeat);
+    int ret = FinishReports(vm, gen.get_reports(), gen.get_elapsed_usec());
+    HttpReq::Fini();
+    return ret;
+  }
   HttpReq::Fini();
   return 0;
 }
@@ -0,0 +1,271 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <boost/format.hpp>
+
+#include "metrics_server.h"
+#include "logging.h"
+#include "errors.h"
+
+static const int METRICS_POLL_MSEC = 200;
+static const int METRICS_REQUEST_MAX = 8192;
+// the exported 'le' bounds: every METRICS_LE_STRIDE histogram buckets,
+// 4 per power of two, from 64 usec to 2^27 usec (134 s)
+static const int METRICS_LE_STRIDE = Histogram::kSubBuckets / 4;
+static const uint64_t METRICS_LE_MIN_USEC = 64;
+static const uint64_t METRICS_LE_MAX_USEC = 1ULL << 27;
+
+MetricsServer::Shard::Shard():
+  requests(0), bytes(0), time_usec_sum(0)
+{
+  for (auto& code: codes) {
+    code = 0;
+  }
+  for (auto& outcome: outcomes) {
+    outcome = 0;
+  }
+  for (auto& bucket: time_usec) {
+    bucket = 0;
+  }
+}
+
+MetricsServer::MetricsServer(const vector<string> &urls):
+  urls_(urls), listen_fd_(-1), stop_(false)
+{
+  size_t n = (size_t)kMaxWorkers * urls_.size();
+  shards_ = new std::atomic<Shard*>[n];
+  for (size_t i = 0; i < n; i++) {
+    shards_[i] = NULL;
+  }
+}
+
+MetricsServer::~MetricsServer()
+{
+  Stop();
+  for (size_t i = 0; i < (size_t)kMaxWorkers * urls_.size(); i++) {
+    delete shards_[i].load();
+  }
+  delete[] shards_;
+}
+
+int MetricsServer::Start(const string &addr, int port)
+{
+  struct sockaddr_in sin;
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(port);
+  if (inet_pton(AF_INET, addr.c_str(), &sin.sin_addr) != 1) {
+    log_error("invalid metrics address '%s'", addr.c_str());
+    return RET_FAIL;
+  }
+
+  listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd_ < 0) {
+    log_error("socket failed: %s", strerror(errno));
+    return RET_FAIL;
+  }
+  int on = 1;
+  setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (bind(listen_fd_, (struct sockaddr *)&sin, sizeof(sin)) != 0 ||
+      listen(listen_fd_, 16) != 0) {
+    log_error("failed to listen on %s:%d: %s", addr.c_str(), port,
+              strerror(errno));
+    close(listen_fd_);
+    listen_fd_ = -1;
+    return RET_FAIL;
+  }
+  thread_ = std::thread(&MetricsServer::Serve, this);
+  return RET_OK;
+}
+
+void MetricsServer::Stop()
+{
+  if (listen_fd_ < 0) {
+    return;
+  }
+  stop_ = true;
+  thread_.join();
+  close(listen_fd_);
+  listen_fd_ = -1;
+}
+
+/* static */
+void MetricsServer::Add(std::atomic<uint64_t> *counter, uint64_t n)
+{
+  // a shard has a single writer, no read-modify-write needed
+  counter->store(counter->load(std::memory_order_relaxed) + n,
+                 std::memory_order_relaxed);
+}
+
+void MetricsServer::Record(int worker, int target, unsigned long http_code,
+                           ReqOutcome outcome, uint64_t bytes, uint64_t time_usec)
+{
+  if (worker >= kMaxWorkers) {
+    static std::atomic<bool> warned(false);
+    if (!warned.exchange(true)) {
+      log_warn("workers from %d on are not counted in the metrics", kMaxWorkers);
+    }
+    return;
+  }
+  std::atomic<Shard*> &slot = shards_[worker * urls_.size() + target];
+  Shard *shard = slot.load(std::memory_order_relaxed);
+  if (shard == NULL) {
+    shard = new Shard();
+    slot.store(shard, std::memory_order_release);
+  }
+  Add(&shard->requests, 1);
+  Add(&shard->bytes, bytes);
+  Add(&shard->time_usec_sum, time_usec);
+  if (outcome != REQ_OK && outcome != REQ_TRUNCATED) {
+    Add(&shard->codes[http_code < (unsigned long)kMaxHttpCode ? http_code : 0], 1);
+  }
+  Add(&shard->outcomes[outcome], 1);
+  Add(&shard->time_usec[Histogram::BucketIndex(time_usec)], 1);
+}
+
+void MetricsServer::Render(string *out) const
+{
+  using boost::format;
+  string requests;
+  string errors;
+  string outcomes;
+  string bytes;
+  string duration;
+
+  for (size_t target = 0; target < urls_.size(); target++) {
+    uint64_t total_requests = 0;
+    uint64_t total_bytes = 0;
+    uint64_t sum_usec = 0;
+    vector<uint64_t> codes(kMaxHttpCode, 0);
+    vector<uint64_t> outcome_counts(REQ_OUTCOMES, 0);
+    vector<uint64_t> buckets(Histogram::kNumBuckets, 0);
+    for (int worker = 0; worker < kMaxWorkers; worker++) {
+      Shard *shard = shards_[worker * urls_.size() + target].load(std::memory_order_acquire);
+      if (shard == NULL) {
+        continue;
+      }
+      total_requests += shard->requests.load(std::memory_order_relaxed);
+      total_bytes += shard->bytes.load(std::memory_order_relaxed);
+      sum_usec += shard->time_usec_sum.load(std::memory_order_relaxed);
+      for (int i = 0; i < kMaxHttpCode; i++) {
+        codes[i] += shard->codes[i].load(std::memory_order_relaxed);
+      }
+      for (int i = 0; i < REQ_OUTCOMES; i++) {
+        outcome_counts[i] += shard->outcomes[i].load(std::memory_order_relaxed);
+      }
+      for (int i = 0; i < Histogram::kNumBuckets; i++) {
+        buckets[i] += shard->time_usec[i].load(std::memory_order_relaxed);
+      }
+    }
+
+    const string &url = urls_[target];
+    requests += str(format("cloud_ping_requests_total{target=\"%s\"} %d\n") %
+                    url % total_requests);
+    bytes += str(format("cloud_ping_bytes_total{target=\"%s\"} %d\n") %
+                 url % total_bytes);
+    for (int code = 0; code < kMaxHttpCode; code++) {
+      if (codes[code] > 0) {
+        errors += str(format("cloud_ping_errors_total{target=\"%s\",code=\"%d\"} %d\n") %
+                      url % code % codes[code]);
+      }
+    }
+    for (int outcome = 0; outcome < REQ_OUTCOMES; outcome++) {
+      if (outcome_counts[outcome] > 0) {
+        outcomes += str(format("cloud_ping_outcomes_total{target=\"%s\",outcome=\"%s\"} %d\n") %
+                        url % ReqOutcomeName(outcome) % outcome_counts[outcome]);
+      }
+    }
+    // the same 'le' set on every scrape, so rate() and histogram_quantile()
+    // work across scrapes
+    uint64_t cumulative = 0;
+    for (int i = 0; i < Histogram::kNumBuckets; i++) {
+      cumulative += buckets[i];
+      uint64_t high = Histogram::BucketHigh(i);
+      if (i % METRICS_LE_STRIDE != METRICS_LE_STRIDE - 1 ||
+          high < METRICS_LE_MIN_USEC || high >= METRICS_LE_MAX_USEC) {
+        continue;
+      }
+      duration += str(format("cloud_ping_request_duration_seconds_bucket{target=\"%s\",le=\"%.6f\"} %d\n") %
+                      url % (Histogram::BucketHigh(i) / 1000000.0) % cumulative);
+    }
+    duration += str(format("cloud_ping_request_duration_seconds_bucket{target=\"%s\",le=\"+Inf\"} %d\n") %
+                    url % cumulative);
+    duration += str(format("cloud_ping_request_duration_seconds_sum{target=\"%s\"} %.6f\n") %
+                    url % (sum_usec / 1000000.0));
+    duration += str(format("cloud_ping_request_duration_seconds_count{target=\"%s\"} %d\n") %
+                    url % cumulative);
+  }
+
+  *out = "# HELP cloud_ping_requests_total Requests sent.\n"
+    "# TYPE cloud_ping_requests_total counter\n" + requests +
+    "# HELP cloud_ping_errors_total Failed requests by HTTP code, 0 without a response.\n"
+    "# TYPE cloud_ping_errors_total counter\n" + errors +
+    "# HELP cloud_ping_outcomes_total Requests by how they ended.\n"
+    "# TYPE cloud_ping_outcomes_total counter\n" + outcomes +
+    "# HELP cloud_ping_bytes_total Response bytes received.\n"
+    "# TYPE cloud_ping_bytes_total counter\n" + bytes +
+    "# HELP cloud_ping_request_duration_seconds Request time.\n"
+    "# TYPE cloud_ping_request_duration_seconds histogram\n" + duration;
+}
+
+void MetricsServer::HandleClient(int fd)
+{
+  string request;
+  char buf[1024];
+  while (request.find("\r\n\r\n") == string::npos &&
+         request.size() < METRICS_REQUEST_MAX) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, METRICS_POLL_MSEC * 5) <= 0) {
+      return;
+    }
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0) {
+      return;
+    }
+    request.append(buf, n);
+  }
+
+  string body;
+  string status = "200 OK";
+  if (request.compare(0, 13, "GET /metrics ") == 0) {
+    Render(&body);
+  }
+  else {
+    status = "404 Not Found";
+    body = "not found\n";
+  }
+  string response = str(boost::format("HTTP/1.1 %s\r\n"
+                                      "Content-Type: text/plain; version=0.0.4\r\n"
+                                      "Content-Length: %d\r\n"
+                                      "Connection: close\r\n\r\n") %
+                        status % body.size()) + body;
+  size_t sent = 0;
+  while (sent < response.size()) {
+    ssize_t n = send(fd, response.data() + sent, response.size() - sent,
+                     MSG_NOSIGNAL);
+    if (n <= 0) {
+      return;
+    }
+    sent += n;
+  }
+}
+
+void MetricsServer::Serve()
+{
+  while (!stop_) {
+    struct pollfd pfd = {listen_fd_, POLLIN, 0};
+    if (poll(&pfd, 1, METRICS_POLL_MSEC) <= 0) {
+      continue;
+    }
+    int fd = accept(listen_fd_, NULL, NULL);
+    if (fd < 0) {
+      continue;
+    }
+    HandleClient(fd);
+    close(fd);
+  }
+}
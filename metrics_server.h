@@ -0,0 +1,59 @@
+#ifndef _METRICS_SERVER_H_
+#define _METRICS_SERVER_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <thread>
+
+#include "histogram.h"
+#include "http_req.h"
+
+using std::string;
+using std::vector;
+
+// Serves the running per-target counters and latency histograms on
+// http://addr:port/metrics in the Prometheus text format. Every worker
+// counts into its own shard with relaxed atomics, a scrape sums the shards
+// and never blocks the workers.
+class MetricsServer
+{
+public:
+  static const int kMaxWorkers = 256;
+  static const int kMaxHttpCode = 600;
+
+  MetricsServer(const vector<string> &urls);
+  ~MetricsServer();
+  int Start(const string &addr, int port);
+  void Stop();
+
+  // http_code 0 is a request without a response
+  void Record(int worker, int target, unsigned long http_code,
+              ReqOutcome outcome, uint64_t bytes, uint64_t time_usec);
+  void Render(string *out) const;
+
+private:
+  struct Shard {
+    Shard();
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> time_usec_sum;
+    std::atomic<uint64_t> codes[kMaxHttpCode];
+    std::atomic<uint64_t> outcomes[REQ_OUTCOMES];
+    std::atomic<uint64_t> time_usec[Histogram::kNumBuckets];
+  };
+  static void Add(std::atomic<uint64_t> *counter, uint64_t n);
+  void Serve();
+  void HandleClient(int fd);
+
+  vector<string> urls_;
+  // shards_[worker * targets + target], allocated by the worker on its
+  // first request
+  std::atomic<Shard*> *shards_;
+  int listen_fd_;
+  std::atomic<bool> stop_;
+  std::thread thread_;
+};
+
+#endif /* _METRICS_SERVER_H_ */
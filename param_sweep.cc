@@ -0,0 +1,195 @@
+#include <algorithm>
+#include <limits>
+#include <boost/format.hpp>
+
+#include "param_sweep.h"
+#include "stat_gen.h"
+#include "logging.h"
+#include "errors.h"
+
+static const char *PARAM_NAMES[] = {
+  "concurrency", "buffer", "rcvbuf", "range", "keepalive"
+};
+
+static const char *OBJECTIVES[] = {
+  "throughput", "reqsec", "p50", "p90", "p99"
+};
+
+ParamSweep::ParamSweep(StatGenerator *gen):
+  gen_(gen)
+{
+}
+
+bool ParamSweep::AddParam(const string &spec)
+{
+  auto eq = spec.find("=");
+  if (eq == string::npos) {
+    return false;
+  }
+
+  Param param;
+  param.name = spec.substr(0, eq);
+  if (std::find(std::begin(PARAM_NAMES), std::end(PARAM_NAMES), param.name) ==
+      std::end(PARAM_NAMES)) {
+    return false;
+  }
+
+  string values = spec.substr(eq+1);
+  size_t pos = 0;
+  while (pos <= values.size()) {
+    auto comma = values.find(",", pos);
+    if (comma == string::npos) {
+      comma = values.size();
+    }
+    string value = values.substr(pos, comma - pos);
+    if (value.empty()) {
+      return false;
+    }
+    param.values.push_back(stoll(value));
+    pos = comma + 1;
+  }
+  if (param.name == "concurrency" &&
+      std::find(param.values.begin(), param.values.end(), 0) != param.values.end()) {
+    return false;
+  }
+  params_.push_back(param);
+  return true;
+}
+
+/* static */
+bool ParamSweep::IsValidObjective(const string &objective)
+{
+  return std::find(std::begin(OBJECTIVES), std::end(OBJECTIVES), objective) !=
+    std::end(OBJECTIVES);
+}
+
+void ParamSweep::ApplyCell(const vector<uint64_t> &values)
+{
+  HttpReqOptions options = gen_->get_req_options();
+  for (size_t i = 0; i < params_.size(); i++) {
+    const string &name = params_[i].name;
+    if (name == "concurrency") {
+      gen_->SetConcurrency(values[i]);
+    }
+    else if (name == "buffer") {
+      options.buffer_size = values[i];
+    }
+    else if (name == "rcvbuf") {
+      options.rcvbuf = values[i];
+    }
+    else if (name == "range") {
+      gen_->SetRange(0, values[i]);
+    }
+    else if (name == "keepalive") {
+      options.keep_alive = values[i] != 0;
+    }
+  }
+  gen_->SetReqOptions(options);
+}
+
+void ParamSweep::Run(int count, int warmup)
+{
+  vector<size_t> idx(params_.size(), 0);
+
+  gen_->SetQuiet(true);
+  while (!StatGenerator::IsExiting()) {
+    vector<uint64_t> values;
+    for (size_t i = 0; i < params_.size(); i++) {
+      values.push_back(params_[i].values[idx[i]]);
+    }
+
+    // no connection or tls session of the previous cell is reused
+    ApplyCell(values);
+    if (HttpReq::ResetConnections() != RET_OK) {
+      return;
+    }
+    // back to back and 'count' rounds per worker, as ConcurrencySearch, so
+    // the throughput of cells with a different concurrency compares
+    int concurrency = gen_->get_concurrency();
+    if (warmup > 0) {
+      gen_->RunTrial(warmup * concurrency, 0, false);
+    }
+    gen_->ResetReports();
+    gen_->RunTrial(count * concurrency, 0, false);
+
+    StatReport total = gen_->GetTotalReport();
+    Cell cell;
+    cell.values = values;
+    cell.requests = total.get_requests();
+    cell.failures = total.get_requests() - total.get_successes();
+    double sec = gen_->get_elapsed_usec() / 1000000.0;
+    cell.mbsec = sec > 0 ? total.get_bytes() / 1048576.0 / sec : 0;
+    cell.reqsec = sec > 0 ? total.get_requests() / sec : 0;
+    cell.p50_msec = total.get_time_usec().Percentile(50) / 1000.0;
+    cell.p90_msec = total.get_time_usec().Percentile(90) / 1000.0;
+    cell.p99_msec = total.get_time_usec().Percentile(99) / 1000.0;
+    cells_.push_back(cell);
+    log_println("cell %ld: %ld requests %.2f MB/s p99 %.2f ms",
+                cells_.size(), cell.requests, cell.mbsec, cell.p99_msec);
+
+    // next cell of the cross-product
+    size_t i = 0;
+    for (; i < params_.size(); i++) {
+      if (++idx[i] < params_[i].values.size()) {
+        break;
+      }
+      idx[i] = 0;
+    }
+    if (i == params_.size()) {
+      break;
+    }
+  }
+}
+
+/* static */
+double ParamSweep::Objective(const Cell &cell, const string &objective)
+{
+  // higher is better, cells with failures rank last
+  if (cell.failures > 0 || cell.requests == 0) {
+    return -std::numeric_limits<double>::infinity();
+  }
+  if (objective == "throughput") {
+    return cell.mbsec;
+  }
+  else if (objective == "reqsec") {
+    return cell.reqsec;
+  }
+  else if (objective == "p50") {
+    return -cell.p50_msec;
+  }
+  else if (objective == "p90") {
+    return -cell.p90_msec;
+  }
+  return -cell.p99_msec;
+}
+
+void ParamSweep::Dump(const string &objective) const
+{
+  vector<Cell> cells = cells_;
+  std::stable_sort(cells.begin(), cells.end(),
+                   [&objective](const Cell &a, const Cell &b) {
+                     return Objective(a, objective) > Objective(b, objective);
+                   });
+
+  log_println("\nparameter sweep (%ld cells, ranked by %s)", cells.size(),
+              objective.c_str());
+  string header = "  rank";
+  for (auto& param: params_) {
+    header += str(boost::format(" %12s") % param.name);
+  }
+  header += str(boost::format(" %8s %8s %10s %10s %10s %10s %10s") %
+                "requests" % "failures" % "MB/s" % "req/s" %
+                "p50 ms" % "p90 ms" % "p99 ms");
+  log_println("%s", header.c_str());
+  for (size_t i = 0; i < cells.size(); i++) {
+    string line = str(boost::format("  %4d") % (i + 1));
+    for (auto value: cells[i].values) {
+      line += str(boost::format(" %12d") % value);
+    }
+    line += str(boost::format(" %8d %8d %10.2f %10.2f %10.2f %10.2f %10.2f") %
+                cells[i].requests % cells[i].failures % cells[i].mbsec %
+                cells[i].reqsec % cells[i].p50_msec % cells[i].p90_msec %
+                cells[i].p99_msec);
+    log_println("%s", line.c_str());
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef _PARAM_SWEEP_H_
+#define _PARAM_SWEEP_H_
+
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+class StatGenerator;
+
+// Runs every cell of the cross-product of the swept client parameters as
+// an isolated, warmed-up trial and ranks the cells by an objective.
+class ParamSweep
+{
+public:
+  explicit ParamSweep(StatGenerator *gen);
+  bool AddParam(const string &spec);
+  static bool IsValidObjective(const string &objective);
+  void Run(int count, int warmup);
+  void Dump(const string &objective) const;
+
+private:
+  struct Param {
+    string name;
+    vector<uint64_t> values;
+  };
+  struct Cell {
+    vector<uint64_t> values;
+    uint64_t requests;
+    uint64_t failures;
+    double mbsec;
+    double reqsec;
+    double p50_msec;
+    double p90_msec;
+    double p99_msec;
+  };
+  void ApplyCell(const vector<uint64_t> &values);
+  static double Objective(const Cell &cell, const string &objective);
+
+  StatGenerator *gen_;
+  vector<Param> params_;
+  vector<Cell> cells_;
+};
+
+#endif /* _PARAM_SWEEP_H_ */
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <map>
+#include <boost/format.hpp>
+#include "logging.h"
+#include "errors.h"
+
+#include "placement.h"
+
+CpuPlacement::CpuPlacement():
+  policy_(COMPACT), nodes_(0)
+{
+}
+
+int CpuPlacement::Init(Policy policy, const string &cpus)
+{
+  cpu_set_t set;
+
+  policy_ = policy;
+  if (cpus.empty()) {
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+      log_error("Failed to read the cpu affinity errno=%d", errno);
+      return RET_FAIL;
+    }
+  }
+  else if (!ParseCpuList(cpus, &set)) {
+    return RET_FAIL;
+  }
+
+  std::map<int, vector<int>> by_node;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &set)) {
+      by_node[NodeOf(cpu)].push_back(cpu);
+    }
+  }
+  nodes_ = by_node.size();
+  cores_.clear();
+  if (policy_ == COMPACT) {
+    for (auto& node: by_node) {
+      cores_.insert(cores_.end(), node.second.begin(), node.second.end());
+    }
+  }
+  else {
+    for (size_t i = 0; cores_.size() < (size_t)CPU_COUNT(&set); i++) {
+      for (auto& node: by_node) {
+        if (i < node.second.size()) {
+          cores_.push_back(node.second[i]);
+        }
+      }
+    }
+  }
+  return cores_.empty() ? RET_FAIL : RET_OK;
+}
+
+const char *CpuPlacement::get_policy_name() const
+{
+  return policy_ == COMPACT ? "compact" : "spread";
+}
+
+/* static */
+int CpuPlacement::Pin(int cpu)
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (ret != 0) {
+    log_warn("Failed to pin thread to cpu %d, ret=%d", cpu, ret);
+    return RET_FAIL;
+  }
+  return RET_OK;
+}
+
+/* static */
+int CpuPlacement::NodeOf(int cpu)
+{
+  string path = boost::str(boost::format("/sys/devices/system/cpu/cpu%d") % cpu);
+  DIR *dir = opendir(path.c_str());
+  int node = 0;
+
+  if (dir == NULL) {
+    return node;
+  }
+  // the cpu directory links to its node as 'nodeN'
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    char *end;
+    if (strncmp(entry->d_name, "node", 4) == 0) {
+      long n = strtol(entry->d_name + 4, &end, 10);
+      if (end != entry->d_name + 4 && *end == '\0') {
+        node = n;
+        break;
+      }
+    }
+  }
+  closedir(dir);
+  return node;
+}
+
+/* static */
+bool CpuPlacement::ParseCpuList(const string &list, cpu_set_t *set)
+{
+  const char *p = list.c_str();
+
+  CPU_ZERO(set);
+  while (*p != '\0') {
+    char *end;
+    long first = strtol(p, &end, 10);
+    long last = first;
+    if (end == p) {
+      log_error("Invalid cpu list '%s'", list.c_str());
+      return false;
+    }
+    p = end;
+    if (*p == '-') {
+      last = strtol(p + 1, &end, 10);
+      if (end == p + 1) {
+        log_error("Invalid cpu list '%s'", list.c_str());
+        return false;
+      }
+      p = end;
+    }
+    if (first < 0 || last < first || last >= CPU_SETSIZE) {
+      log_error("Invalid cpu range %ld-%ld", first, last);
+      return false;
+    }
+    for (long cpu = first; cpu <= last; cpu++) {
+      CPU_SET(cpu, set);
+    }
+    if (*p == ',') {
+      p++;
+    }
+    else if (*p != '\0') {
+      log_error("Invalid cpu list '%s'", list.c_str());
+      return false;
+    }
+  }
+  return CPU_COUNT(set) > 0;
+}
+
+/* static */
+string CpuPlacement::FormatCpuSet(const cpu_set_t &set)
+{
+  string out;
+
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &set)) {
+      continue;
+    }
+    int last = cpu;
+    while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &set)) {
+      last++;
+    }
+    if (!out.empty()) {
+      out += ",";
+    }
+    out += last > cpu ? boost::str(boost::format("%d-%d") % cpu % last) :
+      std::to_string(cpu);
+    cpu = last;
+  }
+  return out;
+}
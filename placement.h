@@ -0,0 +1,43 @@
+#ifndef _PLACEMENT_H_
+#define _PLACEMENT_H_
+
+#include <string>
+#include <vector>
+#include <sched.h>
+
+using std::string;
+using std::vector;
+
+// Assigns worker threads to cores: compact fills the cores of one NUMA node
+// before the next, spread deals them round robin across the nodes. Workers
+// beyond the number of cores wrap around.
+class CpuPlacement
+{
+public:
+  enum Policy {
+    COMPACT = 0,
+    SPREAD
+  };
+
+  CpuPlacement();
+  // 'cpus' like '0-3,8', empty for every cpu the process may run on
+  int Init(Policy policy, const string &cpus);
+  int CoreOf(int worker) const { return cores_[worker % cores_.size()]; }
+  const char *get_policy_name() const;
+  int get_nodes() const { return nodes_; }
+
+  // pins the calling thread to cpu
+  static int Pin(int cpu);
+  // NUMA node of cpu from sysfs, 0 when the kernel has no NUMA support
+  static int NodeOf(int cpu);
+  static bool ParseCpuList(const string &list, cpu_set_t *set);
+  // '0-3,8'
+  static string FormatCpuSet(const cpu_set_t &set);
+
+private:
+  Policy policy_;
+  int nodes_;
+  vector<int> cores_;
+};
+
+#endif /* _PLACEMENT_H_ */
@@ -42,34 +42,20 @@ static string GetDate()
   return buf;
 }
 
-static string GetAuth(const string& bucket,
-                      const string& resource,
-                      const string& secret_key,
-                      const string& date)
+/* static */
+string S3Connection::Sign(const string& bucket,
+                          const string& resource,
+                          const string& secret_key,
+                          const string& date)
 {
   u_char hmac[SHA_DIGEST_LENGTH];
   u_int hmac_len;
-  HMAC_CTX ctx;
   char buf[S3_AUTH_BUF_SIZE];
+  string to_sign = "GET\n\n\n" + date + "\n/" + bucket + resource;
 
-  HMAC_CTX_init(&ctx);
-  HMAC_Init_ex(&ctx, secret_key.c_str(), secret_key.size(),
-               EVP_sha1(), NULL);
-
-  HMAC_Update(&ctx, (const u_char *)"GET", 3);
-  HMAC_Update(&ctx, (const u_char *)"\n", 1);
-  HMAC_Update(&ctx, (const u_char *)"\n", 1);
-  HMAC_Update(&ctx, (const u_char *)"\n", 1);
-  HMAC_Update(&ctx, (const u_char *)date.c_str(), date.size());
-  HMAC_Update(&ctx, (const u_char *)"\n", 1);
-
-  HMAC_Update(&ctx, (const u_char *)"/", 1);
-  HMAC_Update(&ctx, (const u_char *)bucket.c_str(), bucket.size());
-  HMAC_Update(&ctx, (const u_char *)resource.c_str(), resource.size());
-
-  HMAC_Final(&ctx, hmac, &hmac_len);
+  HMAC(EVP_sha1(), secret_key.c_str(), secret_key.size(),
+       (const u_char *)to_sign.c_str(), to_sign.size(), hmac, &hmac_len);
   assert(hmac_len == SHA_DIGEST_LENGTH);
-  HMAC_CTX_cleanup(&ctx);
 
   s3_base64_encode(buf, sizeof(buf), hmac, hmac_len);
   return buf;
@@ -98,9 +84,9 @@ void S3Connection::PerformGet(Statistics *stat)
   string access_key = auth_.substr(0, auth_.find(":"));
   string secret_key = auth_.substr(auth_.find(":")+1);
 
-  string s3_url = string("http://") +  bucket + "." + host  + resource;
+  string s3_url = scheme() +  bucket + "." + host  + resource;
   if (url_.find(":") != string::npos) {
-    s3_url = string("http://") + host + "/" + bucket + resource;
+    s3_url = scheme() + host + "/" + bucket + resource;
   }
   log_info("s3 url: %s", s3_url.c_str());
 
@@ -110,13 +96,14 @@ void S3Connection::PerformGet(Statistics *stat)
   string date = GetDate();
   req.AddHeader(DATE_HEADER, date.c_str());
 
-  string auth = GetAuth(bucket, resource, secret_key, date);
+  string auth = Sign(bucket, resource, secret_key, date);
   boost::format  auth_header("%s: AWS %s:%s");
   auth_header % AUTH_HEADER % access_key % auth;
   req.AddHeader(auth_header.str());
 
   stat->set_url(s3_url);
   ApplyLimits(&req);
+  ApplyReqOptions(&req);
   req.ReportEvents(stat);
   req.PerformGet();
 
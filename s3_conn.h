@@ -6,9 +6,12 @@
 class S3Connection : public CloudConnection
 {
 public:
-  S3Connection(const string &url, const string &auth):
-    CloudConnection(url, auth) {}
+  S3Connection(const string &url, const string &auth, bool secure):
+    CloudConnection(url, auth, secure) {}
   virtual void PerformGet(Statistics *stat);
+  // base64 HMAC-SHA1 signature of a GET of /bucket/resource at date
+  static string Sign(const string& bucket, const string& resource,
+                     const string& secret_key, const string& date);
 };
 
 #endif /* _S3_CONN_H_ */
@@ -0,0 +1,295 @@
+#include <stdlib.h>
+#include <limits.h>
+#include <algorithm>
+#include <numeric>
+#include <thread>
+#include "stat_gen.h"
+#include "logging.h"
+#include "errors.h"
+
+#include "sample_store.h"
+
+// bytes of one request over all columns
+static const size_t SAMPLE_BYTES = 2 * sizeof(uint64_t) +
+  (SampleStore::PHASES + 2) * sizeof(uint32_t);
+static const size_t SAMPLE_CHUNK_BYTES = SampleStore::kChunkSamples * SAMPLE_BYTES;
+// arena blocks double from one chunk up to 64
+static const size_t SAMPLE_ARENA_MAX_BLOCK = 64 * SAMPLE_CHUNK_BYTES;
+// below this many samples a side is selected on the calling thread
+static const size_t SELECT_PARALLEL_MIN = 1 << 16;
+
+SampleArena::SampleArena(size_t first_block, size_t max_block):
+  next_block_(first_block), max_block_(max_block), used_(0), block_size_(0),
+  allocated_(0)
+{
+}
+
+SampleArena::~SampleArena()
+{
+  for (auto block: blocks_) {
+    free(block);
+  }
+}
+
+void *SampleArena::Alloc(size_t size)
+{
+  // sizes are multiples of the column widths, keep 8 byte alignment
+  size = (size + 7) & ~(size_t)7;
+  if (blocks_.empty() || used_ + size > block_size_) {
+    size_t block_size = std::max(size, next_block_);
+    char *block = (char *)malloc(block_size);
+    if (block == NULL) {
+      return NULL;
+    }
+    blocks_.push_back(block);
+    allocated_ += block_size;
+    block_size_ = block_size;
+    used_ = 0;
+    next_block_ = std::min(next_block_ * 2, max_block_);
+  }
+  void *p = blocks_.back() + used_;
+  used_ += size;
+  return p;
+}
+
+void SampleArena::Swap(SampleArena &other)
+{
+  std::swap(next_block_, other.next_block_);
+  std::swap(max_block_, other.max_block_);
+  blocks_.swap(other.blocks_);
+  std::swap(used_, other.used_);
+  std::swap(block_size_, other.block_size_);
+  std::swap(allocated_, other.allocated_);
+}
+
+static bool IsSuccess(uint32_t code, uint32_t outcome)
+{
+  return (outcome == REQ_OK || outcome == REQ_TRUNCATED) && code >= 200 && code < 300;
+}
+
+bool SampleStore::Sample::IsSuccess() const
+{
+  return ::IsSuccess(code, outcome);
+}
+
+SampleStore::SampleStore():
+  arena_(SAMPLE_CHUNK_BYTES, SAMPLE_ARENA_MAX_BLOCK), size_(0)
+{
+}
+
+SampleStore::SampleStore(const SampleStore &other):
+  arena_(SAMPLE_CHUNK_BYTES, SAMPLE_ARENA_MAX_BLOCK), size_(0)
+{
+  Append(other);
+}
+
+SampleStore& SampleStore::operator=(const SampleStore &other)
+{
+  if (this != &other) {
+    SampleStore copy(other);
+    Swap(copy);
+  }
+  return *this;
+}
+
+void SampleStore::Swap(SampleStore &other)
+{
+  arena_.Swap(other.arena_);
+  chunks_.swap(other.chunks_);
+  std::swap(size_, other.size_);
+}
+
+/* static */
+void SampleStore::FromStatistics(const Statistics &stat, Sample *sample)
+{
+  uint64_t phase_usec[PHASES];
+  phase_usec[CONNECT] = Statistics::Usec(stat.GetPhaseTime(REQ_START, HEADERS_SEND_START));
+  phase_usec[WAIT] = Statistics::Usec(stat.GetPhaseTime(HEADERS_SEND_START,
+                                                        HEADERS_RECV_START));
+  phase_usec[TRANSFER] = Statistics::Usec(stat.GetPhaseTime(DATA_RECV_START,
+                                                            DATA_RECV_END));
+  phase_usec[TOTAL] = Statistics::Usec(stat.GetTotalTime());
+  sample->start_usec = Statistics::Usec(stat.GetStartTime());
+  sample->bytes = stat.get_data_size();
+  for (int p = 0; p < PHASES; p++) {
+    // saturates after 71 minutes
+    sample->phase_usec[p] = std::min(phase_usec[p], (uint64_t)UINT_MAX);
+  }
+  sample->code = stat.get_http_code();
+  sample->outcome = stat.get_outcome();
+}
+
+void SampleStore::Add(const Sample &sample)
+{
+  size_t i = size_ % kChunkSamples;
+  if (i == 0) {
+    char *p = (char *)arena_.Alloc(SAMPLE_CHUNK_BYTES);
+    if (p == NULL) {
+      log_warn("out of memory for samples, request not kept");
+      return;
+    }
+    Chunk chunk;
+    chunk.start_usec = (uint64_t *)p;
+    p += kChunkSamples * sizeof(uint64_t);
+    chunk.bytes = (uint64_t *)p;
+    p += kChunkSamples * sizeof(uint64_t);
+    for (int phase = 0; phase < PHASES; phase++) {
+      chunk.phase_usec[phase] = (uint32_t *)p;
+      p += kChunkSamples * sizeof(uint32_t);
+    }
+    chunk.code = (uint32_t *)p;
+    p += kChunkSamples * sizeof(uint32_t);
+    chunk.outcome = (uint32_t *)p;
+    chunks_.push_back(chunk);
+  }
+
+  Chunk &chunk = chunks_.back();
+  chunk.start_usec[i] = sample.start_usec;
+  chunk.bytes[i] = sample.bytes;
+  for (int phase = 0; phase < PHASES; phase++) {
+    chunk.phase_usec[phase][i] = sample.phase_usec[phase];
+  }
+  chunk.code[i] = sample.code;
+  chunk.outcome[i] = sample.outcome;
+  size_++;
+}
+
+void SampleStore::Append(const SampleStore &other)
+{
+  Sample sample;
+  for (size_t i = 0; i < other.size_; i++) {
+    other.Get(i, &sample);
+    Add(sample);
+  }
+}
+
+void SampleStore::Get(size_t i, Sample *sample) const
+{
+  const Chunk &chunk = chunks_[i / kChunkSamples];
+  i %= kChunkSamples;
+  sample->start_usec = chunk.start_usec[i];
+  sample->bytes = chunk.bytes[i];
+  for (int phase = 0; phase < PHASES; phase++) {
+    sample->phase_usec[phase] = chunk.phase_usec[phase][i];
+  }
+  sample->code = chunk.code[i];
+  sample->outcome = chunk.outcome[i];
+}
+
+void SampleStore::SortByStart()
+{
+  vector<uint32_t> order(size_);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+      return chunks_[a / kChunkSamples].start_usec[a % kChunkSamples] <
+        chunks_[b / kChunkSamples].start_usec[b % kChunkSamples];
+    });
+  SampleStore sorted;
+  Sample sample;
+  for (auto i: order) {
+    Get(i, &sample);
+    sorted.Add(sample);
+  }
+  Swap(sorted);
+}
+
+void SampleStore::DropFirst(size_t n)
+{
+  SampleStore rest;
+  Sample sample;
+  for (size_t i = n; i < size_; i++) {
+    Get(i, &sample);
+    rest.Add(sample);
+  }
+  Swap(rest);
+}
+
+void SampleStore::GetSuccessUsec(Phase phase, vector<uint32_t> *values) const
+{
+  for (size_t c = 0; c < chunks_.size(); c++) {
+    const Chunk &chunk = chunks_[c];
+    size_t used = size_ - c * kChunkSamples;
+    if (used > kChunkSamples) {
+      used = kChunkSamples;
+    }
+    for (size_t i = 0; i < used; i++) {
+      if (IsSuccess(chunk.code[i], chunk.outcome[i])) {
+        values->push_back(chunk.phase_usec[phase][i]);
+      }
+    }
+  }
+}
+
+void SampleStore::Write(std::ostream &os, size_t target) const
+{
+  Sample sample;
+  for (size_t i = 0; i < size_; i++) {
+    Get(i, &sample);
+    os << sample.start_usec << "\t" << target << "\t" << sample.code << "\t"
+       << ReqOutcomeName(sample.outcome) << "\t" << sample.bytes;
+    for (int phase = 0; phase < PHASES; phase++) {
+      os << "\t" << sample.phase_usec[phase];
+    }
+    os << "\n";
+  }
+}
+
+/* static */
+const char *SampleStore::PhaseName(Phase phase)
+{
+  static const char *names[PHASES] = {"connect", "wait", "transfer", "total"};
+  return names[phase];
+}
+
+/* static */
+void SampleStore::Select(uint32_t *base, size_t first, size_t last,
+                         const size_t *ranks, size_t num_ranks, int depth)
+{
+  if (num_ranks == 0 || last - first <= 1) {
+    return;
+  }
+  // partition at the middle rank, the ranks on either side are then
+  // selected within their side only, in parallel while the sides are large
+  size_t mid = num_ranks / 2;
+  std::nth_element(base + first, base + ranks[mid], base + last);
+  if (depth > 0 && last - first >= SELECT_PARALLEL_MIN) {
+    std::thread left(&SampleStore::Select, base, first, ranks[mid], ranks, mid,
+                     depth - 1);
+    Select(base, ranks[mid] + 1, last, ranks + mid + 1, num_ranks - mid - 1,
+           depth - 1);
+    left.join();
+  }
+  else {
+    Select(base, first, ranks[mid], ranks, mid, 0);
+    Select(base, ranks[mid] + 1, last, ranks + mid + 1, num_ranks - mid - 1, 0);
+  }
+}
+
+/* static */
+void SampleStore::Percentiles(vector<uint32_t> *values, const vector<double> &percents,
+                              vector<uint32_t> *out)
+{
+  out->assign(percents.size(), 0);
+  size_t n = values->size();
+  if (n == 0) {
+    return;
+  }
+  // nearest rank, as Histogram::Percentile
+  vector<size_t> ranks;
+  for (double percent: percents) {
+    uint64_t rank = (uint64_t)(percent / 100.0 * n + 0.5);
+    ranks.push_back(std::min(std::max(rank, (uint64_t)1), (uint64_t)n) - 1);
+  }
+  vector<size_t> sorted(ranks);
+  std::sort(sorted.begin(), sorted.end());
+  sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+  int depth = 0;
+  while ((1U << depth) < std::thread::hardware_concurrency()) {
+    depth++;
+  }
+  Select(values->data(), 0, n, sorted.data(), sorted.size(), depth);
+  for (size_t i = 0; i < ranks.size(); i++) {
+    (*out)[i] = (*values)[ranks[i]];
+  }
+}
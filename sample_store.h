@@ -0,0 +1,108 @@
+#ifndef _SAMPLE_STORE_H_
+#define _SAMPLE_STORE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <iostream>
+
+using std::string;
+using std::vector;
+
+class Statistics;
+
+// Bump allocator of blocks growing from 'first_block' to 'max_block' bytes,
+// freed all at once with the arena.
+class SampleArena
+{
+public:
+  SampleArena(size_t first_block, size_t max_block);
+  ~SampleArena();
+  void *Alloc(size_t size);
+  void Swap(SampleArena &other);
+  size_t get_allocated() const { return allocated_; }
+
+private:
+  SampleArena(const SampleArena&);
+  SampleArena& operator=(const SampleArena&);
+
+  size_t next_block_;
+  size_t max_block_;
+  vector<char*> blocks_;
+  size_t used_;
+  size_t block_size_;
+  size_t allocated_;
+};
+
+// Requests kept column by column: chunks of kChunkSamples 32 and 64 bit
+// integers per field carved from an arena, 40 bytes per request and no
+// per request object. Single writer; a StatReport keeps one per worker and
+// target, so recording takes no lock and the memory is first touched by
+// the worker's thread.
+class SampleStore
+{
+public:
+  // phases of a request, see Statistics
+  enum Phase {
+    CONNECT = 0,   // start until the headers are sent, dns, tcp and tls
+    WAIT,          // headers sent until the first response byte
+    TRANSFER,      // first until the last body byte
+    TOTAL,         // as in the summary
+    PHASES
+  };
+  // one request, as added and read back
+  struct Sample {
+    uint64_t start_usec;
+    uint64_t bytes;
+    uint32_t phase_usec[PHASES];
+    uint32_t code;
+    uint32_t outcome;
+    // as Statistics::IsSuccess
+    bool IsSuccess() const;
+  };
+  static const size_t kChunkSamples = 4096;
+
+  SampleStore();
+  SampleStore(const SampleStore &other);
+  SampleStore& operator=(const SampleStore &other);
+  void Swap(SampleStore &other);
+
+  static void FromStatistics(const Statistics &stat, Sample *sample);
+  void Add(const Sample &sample);
+  void Append(const SampleStore &other);
+  void Get(size_t i, Sample *sample) const;
+  size_t size() const { return size_; }
+  size_t get_memory_bytes() const { return arena_.get_allocated(); }
+
+  // restores the request order after stores of several workers were
+  // appended
+  void SortByStart();
+  void DropFirst(size_t n);
+  // appends the phase of every successful request to 'values'
+  void GetSuccessUsec(Phase phase, vector<uint32_t> *values) const;
+  // one tab separated line per request
+  void Write(std::ostream &os, size_t target) const;
+
+  // exact nearest rank percentiles, reorders 'values'
+  static void Percentiles(vector<uint32_t> *values, const vector<double> &percents,
+                          vector<uint32_t> *out);
+  static const char *PhaseName(Phase phase);
+
+private:
+  struct Chunk {
+    uint64_t *start_usec;
+    uint64_t *bytes;
+    uint32_t *phase_usec[PHASES];
+    uint32_t *code;
+    uint32_t *outcome;
+  };
+  static void Select(uint32_t *base, size_t first, size_t last,
+                     const size_t *ranks, size_t num_ranks, int depth);
+
+  SampleArena arena_;
+  // every chunk but the last is full
+  vector<Chunk> chunks_;
+  size_t size_;
+};
+
+#endif /* _SAMPLE_STORE_H_ */
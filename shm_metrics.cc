@@ -0,0 +1,184 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "shm_metrics.h"
+#include "logging.h"
+#include "errors.h"
+
+ShmMetrics::ShmMetrics():
+  owner_(false), base_(NULL), size_(0), header_(NULL)
+{
+}
+
+ShmMetrics::~ShmMetrics()
+{
+  Close();
+}
+
+/* static */
+size_t ShmMetrics::SegmentSize(int targets)
+{
+  size_t header = sizeof(Header) + targets * kMaxUrl;
+  header = (header + 63) & ~63UL;
+  return header + (size_t)targets * kMaxWorkers * sizeof(Slot);
+}
+
+ShmMetrics::Slot *ShmMetrics::GetSlot(int worker, int target) const
+{
+  size_t header = (sizeof(Header) + header_->targets * kMaxUrl + 63) & ~63UL;
+  Slot *slots = (Slot *)((char *)base_ + header);
+  return &slots[target * kMaxWorkers + worker];
+}
+
+int ShmMetrics::Create(const string &name, const vector<string> &urls)
+{
+  string path = "/" + name;
+  int fd = shm_open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+  if (fd < 0) {
+    log_error("shm_open '%s' failed: %s", path.c_str(), strerror(errno));
+    return RET_FAIL;
+  }
+  // the pages of unused worker slots are never touched and stay sparse
+  size_ = SegmentSize(urls.size());
+  if (ftruncate(fd, size_) != 0) {
+    log_error("ftruncate '%s' failed: %s", path.c_str(), strerror(errno));
+    close(fd);
+    shm_unlink(path.c_str());
+    return RET_FAIL;
+  }
+  base_ = mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base_ == MAP_FAILED) {
+    log_error("mmap '%s' failed: %s", path.c_str(), strerror(errno));
+    base_ = NULL;
+    shm_unlink(path.c_str());
+    return RET_FAIL;
+  }
+  name_ = path;
+  owner_ = true;
+
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  header_ = (Header *)base_;
+  header_->pid = getpid();
+  header_->targets = urls.size();
+  header_->workers = kMaxWorkers;
+  header_->start_usec = now.tv_sec * 1000000ULL + now.tv_usec;
+  for (size_t i = 0; i < urls.size(); i++) {
+    strncpy(header_->urls[i], urls[i].c_str(), kMaxUrl - 1);
+  }
+  header_->running = 1;
+  header_->version = kVersion;
+  // readers check the magic last
+  std::atomic_thread_fence(std::memory_order_release);
+  header_->magic = kMagic;
+  return RET_OK;
+}
+
+void ShmMetrics::Record(int worker, int target, bool success, uint64_t bytes,
+                        uint64_t time_usec)
+{
+  if (worker >= kMaxWorkers) {
+    static std::atomic<bool> warned(false);
+    if (!warned.exchange(true)) {
+      log_warn("workers from %d on are not published in shared memory", kMaxWorkers);
+    }
+    return;
+  }
+  Slot *slot = GetSlot(worker, target);
+  uint32_t seq = slot->seq.load(std::memory_order_relaxed);
+  slot->seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot->requests++;
+  if (success) {
+    slot->successes++;
+  }
+  slot->bytes += bytes;
+  slot->time_usec[Histogram::BucketIndex(time_usec)]++;
+  slot->seq.store(seq + 2, std::memory_order_release);
+}
+
+void ShmMetrics::Close()
+{
+  if (base_ == NULL) {
+    return;
+  }
+  if (owner_) {
+    header_->running = 0;
+    shm_unlink(name_.c_str());
+  }
+  munmap(base_, size_);
+  base_ = NULL;
+  header_ = NULL;
+}
+
+int ShmMetrics::Attach(const string &name)
+{
+  string path = "/" + name;
+  int fd = shm_open(path.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    log_error("shm_open '%s' failed: %s", path.c_str(), strerror(errno));
+    return RET_FAIL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+    log_error("'%s' is not a cloud-ping metrics segment", path.c_str());
+    close(fd);
+    return RET_FAIL;
+  }
+  size_ = st.st_size;
+  base_ = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base_ == MAP_FAILED) {
+    log_error("mmap '%s' failed: %s", path.c_str(), strerror(errno));
+    base_ = NULL;
+    return RET_FAIL;
+  }
+  header_ = (Header *)base_;
+  if (header_->magic != kMagic || header_->version != kVersion ||
+      SegmentSize(header_->targets) > size_) {
+    log_error("'%s' is not a cloud-ping metrics segment", path.c_str());
+    Close();
+    return RET_FAIL;
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  name_ = path;
+  owner_ = false;
+  return RET_OK;
+}
+
+void ShmMetrics::Read(int target, Snapshot *snapshot) const
+{
+  Slot copy;
+  snapshot->requests = 0;
+  snapshot->successes = 0;
+  snapshot->bytes = 0;
+  snapshot->time_usec.Reset();
+  for (int worker = 0; worker < kMaxWorkers; worker++) {
+    Slot *slot = GetSlot(worker, target);
+    uint32_t seq;
+    do {
+      seq = slot->seq.load(std::memory_order_acquire);
+      if (seq & 1) {
+        continue;
+      }
+      memcpy((char *)&copy + sizeof(copy.seq), (char *)slot + sizeof(copy.seq),
+             sizeof(Slot) - sizeof(copy.seq));
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || slot->seq.load(std::memory_order_relaxed) != seq);
+
+    snapshot->requests += copy.requests;
+    snapshot->successes += copy.successes;
+    snapshot->bytes += copy.bytes;
+    for (int i = 0; i < Histogram::kNumBuckets; i++) {
+      if (copy.time_usec[i] > 0) {
+        snapshot->time_usec.Record(Histogram::BucketLow(i), copy.time_usec[i]);
+      }
+    }
+  }
+}
@@ -0,0 +1,81 @@
+#ifndef _SHM_METRICS_H_
+#define _SHM_METRICS_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "histogram.h"
+
+using std::string;
+using std::vector;
+
+// Running counters of a cloud-ping process in a named POSIX shared memory
+// segment. Every (worker, target) pair has its own slot behind a seqlock:
+// one writer per slot, so writers never contend, and readers copy a slot
+// and retry if its sequence changed, so they never block the writers.
+class ShmMetrics
+{
+public:
+  static const uint32_t kMagic = 0x43504d31;   // "CPM1"
+  static const uint32_t kVersion = 2;
+  static const int kMaxWorkers = 256;
+  static const int kMaxUrl = 256;
+
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pid;
+    uint32_t targets;
+    uint32_t workers;
+    std::atomic<uint32_t> running;
+    uint64_t start_usec;
+    char urls[0][kMaxUrl];
+  };
+  // a cache line of its own, so neighbouring workers do not share one
+  struct alignas(64) Slot {
+    std::atomic<uint32_t> seq;   // odd while a write is in progress
+    uint64_t requests;
+    uint64_t successes;
+    uint64_t bytes;
+    uint64_t time_usec[Histogram::kNumBuckets];
+  };
+  // consistent copy of the slots of one target summed over the workers
+  struct Snapshot {
+    uint64_t requests;
+    uint64_t successes;
+    uint64_t bytes;
+    Histogram time_usec;
+  };
+
+  ShmMetrics();
+  ~ShmMetrics();
+
+  // writer side: creates the segment '/name', workers from kMaxWorkers on
+  // are not recorded
+  int Create(const string &name, const vector<string> &urls);
+  void Record(int worker, int target, bool success, uint64_t bytes,
+              uint64_t time_usec);
+  void Close();
+
+  // reader side
+  int Attach(const string &name);
+  int get_targets() const { return header_->targets; }
+  const char *get_url(int target) const { return header_->urls[target]; }
+  bool IsRunning() const { return header_->running.load(); }
+  uint32_t get_pid() const { return header_->pid; }
+  void Read(int target, Snapshot *snapshot) const;
+
+private:
+  Slot *GetSlot(int worker, int target) const;
+  static size_t SegmentSize(int targets);
+
+  string name_;
+  bool owner_;
+  void *base_;
+  size_t size_;
+  Header *header_;
+};
+
+#endif /* _SHM_METRICS_H_ */
@@ -0,0 +1,146 @@
+#include <math.h>
+#include <algorithm>
+#include <random>
+#include <limits>
+#include <boost/math/distributions/students_t.hpp>
+
+#include "size_sweep.h"
+#include "cloud_conn.h"
+#include "stat_gen.h"
+#include "logging.h"
+
+static std::mt19937 sweep_rng_g(std::random_device{}());
+
+SizeSweep::SizeSweep(CloudConnection *conn, uint64_t min_size,
+                     uint64_t max_size, double factor):
+  conn_(conn), rounds_(0)
+{
+  double size = std::max(min_size, (uint64_t)1);
+  while ((uint64_t)size <= max_size) {
+    if (sizes_.empty() || sizes_.back() != (uint64_t)size) {
+      sizes_.push_back((uint64_t)size);
+    }
+    size *= factor;
+  }
+  if (sizes_.empty() || sizes_.back() != max_size) {
+    sizes_.push_back(max_size);
+  }
+  size_msecs_.resize(sizes_.size());
+}
+
+void SizeSweep::RunRound()
+{
+  vector<size_t> order;
+  for (size_t i = 0; i < sizes_.size(); i++) {
+    order.push_back(i);
+  }
+  // interleave the sizes so drift during the run hits all of them equally
+  std::shuffle(order.begin(), order.end(), sweep_rng_g);
+
+  for (auto idx: order) {
+    Statistics stat;
+    conn_->SetLimits(0, sizes_[idx], 0);
+    conn_->PerformGet(&stat);
+    if (url_.empty()) {
+      url_ = stat.get_url();
+    }
+    if (!stat.IsSuccess()) {
+      log_println("size sweep: %s size=%ld code=%ld",
+                  stat.get_url().c_str(), sizes_[idx], stat.get_http_code());
+      continue;
+    }
+    double msec = Statistics::Msec(stat.GetTotalTime());
+    bytes_.push_back(stat.get_data_size());
+    msecs_.push_back(msec);
+    size_msecs_[idx].push_back(msec);
+  }
+  rounds_++;
+}
+
+bool SizeSweep::FitModel(Fit *fit) const
+{
+  size_t n = bytes_.size();
+  if (n < 3) {
+    return false;
+  }
+
+  double x_mean = 0;
+  double y_mean = 0;
+  for (size_t i = 0; i < n; i++) {
+    x_mean += bytes_[i];
+    y_mean += msecs_[i];
+  }
+  x_mean /= n;
+  y_mean /= n;
+
+  double sxx = 0;
+  double sxy = 0;
+  double syy = 0;
+  for (size_t i = 0; i < n; i++) {
+    sxx += (bytes_[i] - x_mean) * (bytes_[i] - x_mean);
+    sxy += (bytes_[i] - x_mean) * (msecs_[i] - y_mean);
+    syy += (msecs_[i] - y_mean) * (msecs_[i] - y_mean);
+  }
+  if (sxx == 0) {
+    return false;
+  }
+
+  double slope = sxy / sxx;
+  double intercept = y_mean - slope * x_mean;
+  double ssr = std::max(syy - slope * sxy, 0.0);
+  double s2 = ssr / (n - 2);
+  boost::math::students_t dist(n - 2);
+  double t = boost::math::quantile(boost::math::complement(dist, 0.025));
+
+  fit->samples = n;
+  fit->overhead_msec = intercept;
+  fit->overhead_ci_msec = t * sqrt(s2 * (1.0 / n + x_mean * x_mean / sxx));
+  fit->msec_per_byte = slope;
+  fit->msec_per_byte_ci = t * sqrt(s2 / sxx);
+  fit->r2 = syy > 0 ? 1 - ssr / syy : 1;
+  return true;
+}
+
+static double MBsecFromSlope(double msec_per_byte)
+{
+  if (msec_per_byte <= 0) {
+    return std::numeric_limits<double>::infinity();
+  }
+  return 1000.0 / msec_per_byte / 1048576;
+}
+
+void SizeSweep::Dump() const
+{
+  log_println("\nsize sweep %s (%ld rounds)", url_.c_str(), rounds_);
+  log_println("  %12s %8s %10s %10s", "size", "requests", "p50 ms", "mean ms");
+  for (size_t i = 0; i < sizes_.size(); i++) {
+    vector<double> msecs = size_msecs_[i];
+    if (msecs.empty()) {
+      log_println("  %12ld %8d %10s %10s", sizes_[i], 0, "-", "-");
+      continue;
+    }
+    std::sort(msecs.begin(), msecs.end());
+    double sum = 0;
+    for (auto msec: msecs) {
+      sum += msec;
+    }
+    log_println("  %12ld %8ld %10.2f %10.2f", sizes_[i], msecs.size(),
+                msecs[msecs.size() / 2], sum / msecs.size());
+  }
+
+  Fit fit;
+  if (!FitModel(&fit)) {
+    log_println("  not enough samples to fit latency = overhead + size / bandwidth");
+    return;
+  }
+  log_println("  fit latency = overhead + size / bandwidth (95%% confidence, n=%ld, r^2=%.3f)",
+              fit.samples, fit.r2);
+  log_println("  overhead  %.3f ms [%.3f, %.3f]",
+              fit.overhead_msec,
+              fit.overhead_msec - fit.overhead_ci_msec,
+              fit.overhead_msec + fit.overhead_ci_msec);
+  log_println("  bandwidth %.2f MB/s [%.2f, %.2f]",
+              MBsecFromSlope(fit.msec_per_byte),
+              MBsecFromSlope(fit.msec_per_byte + fit.msec_per_byte_ci),
+              MBsecFromSlope(fit.msec_per_byte - fit.msec_per_byte_ci));
+}
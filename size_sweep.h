@@ -0,0 +1,43 @@
+#ifndef _SIZE_SWEEP_H_
+#define _SIZE_SWEEP_H_
+
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+class CloudConnection;
+
+// Walks a geometric series of range sizes on one object, in a random order
+// every round, and fits latency = overhead + size / bandwidth.
+class SizeSweep
+{
+public:
+  SizeSweep(CloudConnection *conn, uint64_t min_size, uint64_t max_size,
+            double factor);
+  void RunRound();
+  void Dump() const;
+
+  struct Fit {
+    uint64_t samples;
+    double overhead_msec;
+    double overhead_ci_msec;
+    double msec_per_byte;
+    double msec_per_byte_ci;
+    double r2;
+  };
+  bool FitModel(Fit *fit) const;
+
+private:
+  CloudConnection *conn_;
+  string url_;
+  vector<uint64_t> sizes_;
+  // latency samples as (received bytes, msec) pairs
+  vector<double> bytes_;
+  vector<double> msecs_;
+  vector<vector<double>> size_msecs_;
+  uint64_t rounds_;
+};
+
+#endif /* _SIZE_SWEEP_H_ */
@@ -0,0 +1,134 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fstream>
+#include <sstream>
+
+#include "stat_file.h"
+#include "logging.h"
+#include "errors.h"
+
+static const char *STAT_FILE_MAGIC = "cloud-ping-stats";
+
+/* static */
+void StatFile::Write(std::ostream &os, const vector<StatReport> &reports,
+                     uint64_t elapsed_usec)
+{
+  os << STAT_FILE_MAGIC << " " << kVersion << "\n";
+  os << "elapsed_usec " << elapsed_usec << "\n";
+  for (auto& report: reports) {
+    report.Save(os);
+  }
+}
+
+/* static */
+int StatFile::Read(std::istream &is, vector<StatReport> *reports,
+                   uint64_t *elapsed_usec)
+{
+  string magic;
+  string key;
+  int version;
+
+  if (!(is >> magic >> version) || magic != STAT_FILE_MAGIC) {
+    log_error("not a cloud-ping stats stream");
+    return RET_FAIL;
+  }
+  if (version < 1 || version > kVersion) {
+    log_error("unsupported stats version %d", version);
+    return RET_FAIL;
+  }
+  if (!(is >> key >> *elapsed_usec) || key != "elapsed_usec") {
+    log_error("stats are missing the elapsed time");
+    return RET_FAIL;
+  }
+  while (is >> std::ws && !is.eof()) {
+    StatReport report;
+    if (!report.Load(is)) {
+      log_error("malformed stats target");
+      return RET_FAIL;
+    }
+    reports->push_back(report);
+  }
+  return RET_OK;
+}
+
+/* static */
+int StatFile::Save(const string &path, const vector<StatReport> &reports,
+                   uint64_t elapsed_usec)
+{
+  std::ofstream os(path.c_str());
+  if (!os) {
+    log_error("failed to open '%s' for writing", path.c_str());
+    return RET_FAIL;
+  }
+  Write(os, reports, elapsed_usec);
+  if (!os) {
+    log_error("failed to write '%s'", path.c_str());
+    return RET_FAIL;
+  }
+  return RET_OK;
+}
+
+/* static */
+int StatFile::Load(const string &path, vector<StatReport> *reports,
+                   uint64_t *elapsed_usec)
+{
+  std::ifstream is(path.c_str());
+  if (!is) {
+    log_error("failed to open '%s'", path.c_str());
+    return RET_FAIL;
+  }
+  if (Read(is, reports, elapsed_usec) != RET_OK) {
+    log_error("failed to load '%s'", path.c_str());
+    return RET_FAIL;
+  }
+  return RET_OK;
+}
+
+/* static */
+int StatFile::Send(const string &socket_path, const vector<StatReport> &reports,
+                   uint64_t elapsed_usec)
+{
+  struct sockaddr_un addr;
+  std::ostringstream os;
+  Write(os, reports, elapsed_usec);
+  string data = os.str();
+
+  if (socket_path.size() >= sizeof(addr.sun_path)) {
+    log_error("socket path '%s' is too long", socket_path.c_str());
+    return RET_FAIL;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_path.c_str());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    log_error("socket failed: %s", strerror(errno));
+    return RET_FAIL;
+  }
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    log_error("failed to connect to '%s': %s", socket_path.c_str(),
+              strerror(errno));
+    close(fd);
+    return RET_FAIL;
+  }
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = write(fd, data.data() + sent, data.size() - sent);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      log_error("failed to send stats to '%s': %s", socket_path.c_str(),
+                strerror(errno));
+      close(fd);
+      return RET_FAIL;
+    }
+    sent += n;
+  }
+  close(fd);
+  return RET_OK;
+}
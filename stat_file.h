@@ -0,0 +1,38 @@
+#ifndef _STAT_FILE_H_
+#define _STAT_FILE_H_
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "stat_report.h"
+
+using std::string;
+using std::vector;
+
+// Versioned text format with the reports of a run:
+//   cloud-ping-stats <version>
+//   elapsed_usec <usec>
+//   target <url> ... end      (one block per StatReport)
+// Histograms are saved bucket by bucket, so reports of several processes
+// merge without losing precision.
+class StatFile
+{
+public:
+  static const int kVersion = 4;
+
+  static void Write(std::ostream &os, const vector<StatReport> &reports,
+                    uint64_t elapsed_usec);
+  static int Read(std::istream &is, vector<StatReport> *reports,
+                  uint64_t *elapsed_usec);
+
+  static int Save(const string &path, const vector<StatReport> &reports,
+                  uint64_t elapsed_usec);
+  static int Load(const string &path, vector<StatReport> *reports,
+                  uint64_t *elapsed_usec);
+  // sends the reports to an aggregator listening on a unix socket
+  static int Send(const string &socket_path, const vector<StatReport> &reports,
+                  uint64_t elapsed_usec);
+};
+
+#endif /* _STAT_FILE_H_ */
@@ -1,19 +1,45 @@
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <string.h>
 #include <signal.h>
 #include <functional>
+#include <set>
+#include <fstream>
 #include <boost/numeric/conversion/cast.hpp>
-#include <boost/accumulators/accumulators.hpp>
-#include <boost/accumulators/statistics.hpp>
-#include <boost/accumulators/statistics/count.hpp>
+#include <boost/format.hpp>
 
 #include "stat_gen.h"
+#include "size_sweep.h"
 #include "logging.h"
+#include "errors.h"
 
 using boost::numeric_cast;
-using namespace boost::accumulators;
 
-static bool exiting_g = false;
+static std::atomic<bool> exiting_g(false);
+static std::atomic<bool> report_requested_g(false);
+
+static const int PRECISION_BATCH_ROUNDS = 10;
+static const int REPORTER_POLL_USEC = 100000;
+
+uint64_t Statistics::stall_threshold_usec_ = 200000;
+uint64_t Statistics::ramp_bucket_usec_ = 0;
+
+StatGenerator::StatGenerator():
+  concurrency_(1), quiet_(false), detect_warmup_(false), precision_(false),
+  report_interval_usec_(0), shm_(NULL), metrics_(NULL),
+  cpu_accounting_(false), placement_(NULL), heatmap_(NULL),
+  exact_percentiles_(false), hedger_(NULL), hedge_conn_(NULL), rounds_left_(0), elapsed_usec_(0)
+{
+}
+
+StatGenerator::~StatGenerator()
+{
+  delete shm_;
+  delete metrics_;
+  delete hedger_;
+  delete placement_;
+  delete heatmap_;
+}
 
 void StatGenerator::AddConnection(const string& url,
                                   const string& auth,
@@ -25,8 +51,48 @@ void StatGenerator::AddConnection(const string& url,
   CloudConnection *conn = CloudConnectionFactory::NewConnection(url, auth);
   if (conn) {
     conn->SetLimits(range_start, range_end, len);
+    conn->SetReqOptions(req_options_);
     connections_.push_back(conn);
+    reports_.push_back(StatReport());
+  }
+}
+
+void StatGenerator::SetReqOptions(const HttpReqOptions &options)
+{
+  req_options_ = options;
+  for (auto conn: connections_) {
+    conn->SetReqOptions(req_options_);
+  }
+  if (hedge_conn_ != NULL) {
+    hedge_conn_->SetReqOptions(req_options_);
+  }
+}
+
+void StatGenerator::SetRange(uint64_t range_start, uint64_t range_end)
+{
+  for (auto conn: connections_) {
+    conn->SetRange(range_start, range_end);
+  }
+  if (hedge_conn_ != NULL) {
+    hedge_conn_->SetRange(range_start, range_end);
+  }
+}
+
+int StatGenerator::SetHedge(uint64_t delay_usec, const string& url,
+                            const string& auth, uint64_t range_start,
+                            uint64_t range_end, size_t len)
+{
+  if (!url.empty()) {
+    hedge_conn_ = CloudConnectionFactory::NewConnection(url, auth);
+    if (hedge_conn_ == NULL) {
+      return RET_FAIL;
+    }
+    hedge_conn_->SetLimits(range_start, range_end, len);
+    hedge_conn_->SetReqOptions(req_options_);
   }
+  hedger_ = new Hedger(delay_usec, connections_.size());
+  hedger_->SetHedgeConnection(hedge_conn_);
+  return RET_OK;
 }
 
 static void OnExit(int sig)
@@ -37,44 +103,520 @@ static void OnExit(int sig)
   exiting_g = true;
 }
 
+// Control-Break (SIGQUIT), the reporter thread prints the interval
+static void OnReport(int sig)
+{
+  report_requested_g = true;
+}
+
+/* static */
 void StatGenerator::HandleCntrlC()
 {
   struct sigaction sa;
 	memset(&sa, 0, sizeof(sa));
 	sa.sa_handler = OnExit;
 	sigaction(SIGINT, &sa, NULL);
+	sa.sa_handler = OnReport;
+	sigaction(SIGQUIT, &sa, NULL);
+}
+
+int StatGenerator::PublishShm(const string& name)
+{
+  vector<string> urls;
+  for (auto conn: connections_) {
+    urls.push_back(conn->get_url());
+  }
+  if (concurrency_ > ShmMetrics::kMaxWorkers) {
+    log_error("shared memory metrics support at most %d workers",
+              ShmMetrics::kMaxWorkers);
+    return RET_FAIL;
+  }
+  shm_ = new ShmMetrics();
+  if (shm_->Create(name, urls) != RET_OK) {
+    delete shm_;
+    shm_ = NULL;
+    return RET_FAIL;
+  }
+  return RET_OK;
+}
+
+int StatGenerator::StartMetricsServer(const string& addr, int port)
+{
+  vector<string> urls;
+  for (auto conn: connections_) {
+    urls.push_back(conn->get_url());
+  }
+  if (concurrency_ > MetricsServer::kMaxWorkers) {
+    log_error("the metrics server supports at most %d workers",
+              MetricsServer::kMaxWorkers);
+    return RET_FAIL;
+  }
+  metrics_ = new MetricsServer(urls);
+  if (metrics_->Start(addr, port) != RET_OK) {
+    delete metrics_;
+    metrics_ = NULL;
+    return RET_FAIL;
+  }
+  return RET_OK;
+}
+
+/* static */
+bool StatGenerator::IsExiting()
+{
+  return exiting_g;
+}
+
+int StatGenerator::SetPlacement(CpuPlacement::Policy policy, const string& cpus)
+{
+  delete placement_;
+  placement_ = new CpuPlacement();
+  if (placement_->Init(policy, cpus) != RET_OK) {
+    delete placement_;
+    placement_ = NULL;
+    return RET_FAIL;
+  }
+  return RET_OK;
+}
+
+void StatGenerator::SetHeatmap(const string& path, uint64_t window_usec)
+{
+  delete heatmap_;
+  heatmap_ = new Heatmap(window_usec);
+  heatmap_path_ = path;
+}
+
+void StatGenerator::SetExactPercentiles(const string& path)
+{
+  exact_percentiles_ = true;
+  samples_path_ = path;
 }
 
 void StatGenerator::Run(int count, int interval, bool repeat)
 {
-  accumulator_set<double, stats<tag::count, tag::min, tag::max, tag::mean > > time_acc;
-  accumulator_set<double, stats<tag::count, tag::min, tag::max, tag::mean > > speed_acc;
   log_info("");
   HandleCntrlC();
-  while (!exiting_g && count > 0) {
+  if (precision_) {
+    RunUntilPrecise(count, interval, repeat);
+  }
+  else {
+    RunTrial(count, interval, repeat);
+  }
+  if (detect_warmup_) {
+    for (auto& report: reports_) {
+      report.TrimWarmup();
+    }
+  }
+  DumpSummary();
+  if (hedger_ != NULL) {
+    vector<string> urls;
     for (auto conn: connections_) {
+      urls.push_back(conn->get_url());
+    }
+    hedger_->Dump(urls);
+  }
+  if (cpu_accounting_) {
+    DumpCpuUsage();
+  }
+  if (placement_ != NULL || cpu_accounting_) {
+    DumpPlacement();
+  }
+  if (heatmap_ != NULL) {
+    heatmap_->Render();
+    heatmap_->Save(heatmap_path_);
+  }
+  if (exact_percentiles_) {
+    DumpExactPercentiles();
+    if (!samples_path_.empty()) {
+      SaveSamples(samples_path_);
+    }
+  }
+}
+
+void StatGenerator::RunUntilPrecise(int count, int interval, bool repeat)
+{
+  // -n caps the run, the confidence interval is checked between batches
+  int batch = std::max(PRECISION_BATCH_ROUNDS, concurrency_);
+  while (!exiting_g && (repeat || count > 0)) {
+    int rounds = repeat ? batch : std::min(batch, count);
+    RunTrial(rounds, interval, false);
+    count -= rounds;
+
+    bool precise = true;
+    for (auto& report: reports_) {
+      if (!report.IsPrecise()) {
+        precise = false;
+        break;
+      }
+    }
+    if (precise) {
+      log_info("confidence interval reached the target width");
+      break;
+    }
+  }
+}
+
+void StatGenerator::RunTrial(int count, int interval, bool repeat)
+{
+  struct timeval start;
+  struct timeval end;
+  vector<Worker> workers(concurrency_);
+  std::atomic<bool> done(false);
+
+  // the workers share the rounds, -n counts rounds of the whole run
+  rounds_left_ = count;
+  if (heatmap_ != NULL) {
+    heatmap_->Start();
+  }
+  gettimeofday(&start, NULL);
+  for (int i = 0; i < concurrency_; i++) {
+    workers[i].id = i;
+    workers[i].thread = std::thread(&StatGenerator::RunWorker, this,
+                                    &workers[i], interval, repeat);
+  }
+  std::thread reporter(&StatGenerator::RunReporter, this, &workers, &done);
+  for (auto& worker: workers) {
+    worker.thread.join();
+  }
+  done = true;
+  reporter.join();
+  if (worker_cpu_.size() < workers.size()) {
+    worker_cpu_.resize(workers.size());
+  }
+  for (auto& worker: workers) {
+    for (size_t i = 0; i < connections_.size(); i++) {
+      reports_[i].Merge(worker.reports[i]);
+      worker_cpu_[worker.id].requests += worker.reports[i].get_requests();
+      worker_cpu_[worker.id].bytes += worker.reports[i].get_bytes();
+    }
+    WorkerCpu &worker_cpu = worker_cpu_[worker.id];
+    worker_cpu.cpu.Add(worker.cpu);
+    worker_cpu.pinned_core = placement_ != NULL ? placement_->CoreOf(worker.id) : -1;
+    CPU_OR(&worker_cpu.cores, &worker_cpu.cores, &worker.cores);
+    worker_cpu.core_changes += worker.core_changes;
+  }
+  gettimeofday(&end, NULL);
+  elapsed_usec_ += Statistics::Usec(Statistics::Diff(&start, &end));
+}
+
+void StatGenerator::RunWorker(Worker *worker, int interval, bool repeat)
+{
+  CpuUsage cpu;
+  if (placement_ != NULL) {
+    CpuPlacement::Pin(placement_->CoreOf(worker->id));
+  }
+  worker->reports.resize(connections_.size());
+  worker->live.reset(new LiveStats());
+  worker->ready = true;
+  if (cpu_accounting_) {
+    cpu.Start();
+  }
+  while (!exiting_g) {
+    if (!repeat && rounds_left_.fetch_sub(1) <= 0) {
+      break;
+    }
+    for (size_t i = 0; i < connections_.size() && !exiting_g; i++) {
       Statistics stat;
-      conn->PerformGet(&stat);
-      time_acc(Statistics::Msec(stat.GetTotalTime()));
-      speed_acc(Statistics::MBsec(stat.GetTotalTime(),
-                                  stat.get_data_size()));
-      DumpStatistics(stat);
+      if (hedger_ != NULL) {
+        hedger_->PerformGet(i, connections_[i], &stat);
+      }
+      else {
+        connections_[i]->PerformGet(&stat);
+      }
+      worker->reports[i].Add(stat);
+      worker->live->Add(stat);
+      int core = sched_getcpu();
+      if (core >= 0 && core < CPU_SETSIZE) {
+        CPU_SET(core, &worker->cores);
+        if (worker->last_core >= 0 && core != worker->last_core) {
+          worker->core_changes++;
+        }
+        worker->last_core = core;
+      }
+      if (shm_ != NULL) {
+        shm_->Record(worker->id, i, stat.IsSuccess(), stat.get_data_size(),
+                     Statistics::Usec(stat.GetTotalTime()));
+      }
+      if (metrics_ != NULL) {
+        metrics_->Record(worker->id, i, stat.get_http_code(),
+                         stat.get_outcome(), stat.get_data_size(),
+                         Statistics::Usec(stat.GetTotalTime()));
+      }
+      if (!quiet_) {
+        DumpStatistics(stat);
+      }
+    }
+    sleep(interval);
+  }
+  if (cpu_accounting_) {
+    cpu.Read(&worker->cpu);
+  }
+}
+
+static void DumpInterval(double at_sec, double sec, const IntervalStats &interval,
+                         const IntervalStats &total)
+{
+  log_println("[+%.1fs] %ld requests %ld failed %.2f MB/s %.2f req/s "
+              "p50/p90/p99 = %.2f/%.2f/%.2f ms, total p50/p90/p99 = %.2f/%.2f/%.2f ms",
+              at_sec, interval.requests, interval.requests - interval.successes,
+              sec > 0 ? interval.bytes / 1048576.0 / sec : 0,
+              sec > 0 ? interval.requests / sec : 0,
+              interval.time_usec.Percentile(50) / 1000.0,
+              interval.time_usec.Percentile(90) / 1000.0,
+              interval.time_usec.Percentile(99) / 1000.0,
+              total.time_usec.Percentile(50) / 1000.0,
+              total.time_usec.Percentile(90) / 1000.0,
+              total.time_usec.Percentile(99) / 1000.0);
+}
+
+void StatGenerator::DrainWorkers(vector<Worker> *workers, const struct timeval &now,
+                                 IntervalStats *interval)
+{
+  IntervalStats drained;
+  for (auto& worker: *workers) {
+    if (worker.ready) {
+      worker.live->Drain(&drained);
+    }
+  }
+  // requests land in the heatmap window of the poll that drained them
+  if (heatmap_ != NULL) {
+    heatmap_->Add(now, drained.time_usec);
+  }
+  interval->Merge(drained);
+}
+
+void StatGenerator::RunReporter(vector<Worker> *workers,
+                                const std::atomic<bool> *done)
+{
+  struct timeval start;
+  struct timeval last;
+  struct timeval now;
+  IntervalStats total;
+  // drained since the last interval report
+  IntervalStats interval;
+
+  gettimeofday(&start, NULL);
+  last = start;
+  while (!*done) {
+    usleep(REPORTER_POLL_USEC);
+    gettimeofday(&now, NULL);
+    if (heatmap_ != NULL) {
+      DrainWorkers(workers, now, &interval);
+    }
+    uint64_t usec = Statistics::Usec(Statistics::Diff(&last, &now));
+    bool due = report_interval_usec_ > 0 && usec >= report_interval_usec_;
+    if (!report_requested_g.exchange(false) && !due) {
+      continue;
+    }
+    DrainWorkers(workers, now, &interval);
+    total.Merge(interval);
+    DumpInterval(Statistics::Usec(Statistics::Diff(&start, &now)) / 1000000.0,
+                 usec / 1000000.0, interval, total);
+    interval.Reset();
+    last = now;
+  }
+  // the workers are joined, pick up their last requests
+  if (heatmap_ != NULL) {
+    gettimeofday(&now, NULL);
+    DrainWorkers(workers, now, &interval);
+  }
+}
+
+void StatGenerator::ResetReports()
+{
+  for (auto& report: reports_) {
+    report = StatReport();
+  }
+  elapsed_usec_ = 0;
+}
+
+StatReport StatGenerator::GetTotalReport() const
+{
+  StatReport total;
+  for (auto& report: reports_) {
+    total.Merge(report);
+  }
+  return total;
+}
+
+void StatGenerator::DumpSummary() const
+{
+  GetTotalReport().DumpTotals();
+  for (auto& report: reports_) {
+    report.Dump();
+  }
+}
+
+static void DumpCpuCounters(const char *name, const CpuCounters &cpu,
+                            uint64_t requests, uint64_t bytes)
+{
+  double mb = bytes / 1048576.0;
+  log_println("  %-9s %ld requests %.2f MB, cpu %.2f ms (user %.2f sys %.2f), "
+              "%.1f us/request %.1f us/MB",
+              name, requests, mb, cpu.cpu_usec() / 1000.0,
+              cpu.user_usec / 1000.0, cpu.sys_usec / 1000.0,
+              requests > 0 ? (double)cpu.cpu_usec() / requests : 0,
+              mb > 0 ? cpu.cpu_usec() / mb : 0);
+  log_println("  %-9s context switches %ld voluntary %ld involuntary, "
+              "page faults %ld minor %ld major", "",
+              cpu.voluntary_switches, cpu.involuntary_switches,
+              cpu.minor_faults, cpu.major_faults);
+  if (cpu.has_perf) {
+    log_println("  %-9s %.0f cycles/request %.0f cycles/MB, IPC %.2f", "",
+                requests > 0 ? (double)cpu.cycles / requests : 0,
+                mb > 0 ? cpu.cycles / mb : 0,
+                cpu.cycles > 0 ? (double)cpu.instructions / cpu.cycles : 0);
+  }
+}
+
+void StatGenerator::DumpCpuUsage() const
+{
+  CpuCounters total;
+  uint64_t requests = 0;
+  uint64_t bytes = 0;
+
+  log_println("\nclient cpu per worker%s", worker_cpu_.empty() ||
+              worker_cpu_[0].cpu.has_perf ? "" : " (perf counters unavailable)");
+  for (size_t i = 0; i < worker_cpu_.size(); i++) {
+    const WorkerCpu &worker = worker_cpu_[i];
+    string name = str(boost::format("worker %d") % i);
+    DumpCpuCounters(name.c_str(), worker.cpu, worker.requests, worker.bytes);
+    total.Add(worker.cpu);
+    requests += worker.requests;
+    bytes += worker.bytes;
+  }
+  if (worker_cpu_.size() > 1) {
+    DumpCpuCounters("total", total, requests, bytes);
+  }
+
+  // curl resolver threads, the reporter and the main thread are only in
+  // the process usage
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  uint64_t process_usec = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ULL +
+    usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+  log_println("  process   cpu %.2f ms = %.1f%% of one core over %.2f s of requests",
+              process_usec / 1000.0,
+              elapsed_usec_ > 0 ? process_usec * 100.0 / elapsed_usec_ : 0,
+              elapsed_usec_ / 1000000.0);
+}
+
+void StatGenerator::DumpPlacement() const
+{
+  string busy_poll;
+  if (req_options_.busy_poll_usec > 0) {
+    busy_poll = str(boost::format(", busy poll %d usec") % req_options_.busy_poll_usec);
+  }
+  if (placement_ != NULL) {
+    log_println("\nworker placement (%s over %d nodes%s)",
+                placement_->get_policy_name(), placement_->get_nodes(),
+                busy_poll.c_str());
+  }
+  else {
+    log_println("\nworker placement (not pinned%s)", busy_poll.c_str());
+  }
+  for (size_t i = 0; i < worker_cpu_.size(); i++) {
+    const WorkerCpu &worker = worker_cpu_[i];
+    std::set<int> nodes;
+    for (int core = 0; core < CPU_SETSIZE; core++) {
+      if (CPU_ISSET(core, &worker.cores)) {
+        nodes.insert(CpuPlacement::NodeOf(core));
+      }
+    }
+    string ran_nodes;
+    for (int node: nodes) {
+      ran_nodes += (ran_nodes.empty() ? "" : ",") + std::to_string(node);
+    }
+    string pinned = "not pinned";
+    if (worker.pinned_core >= 0) {
+      pinned = str(boost::format("pinned to cpu %d node %d") % worker.pinned_core %
+                   CpuPlacement::NodeOf(worker.pinned_core));
+    }
+    log_println("  worker %-3ld %s, ran on cpus %s (nodes %s), %ld core changes",
+                i, pinned.c_str(), CpuPlacement::FormatCpuSet(worker.cores).c_str(),
+                ran_nodes.c_str(), worker.core_changes);
+  }
+}
+
+void StatGenerator::RunSizeSweep(uint64_t min_size, uint64_t max_size,
+                                 double factor, int count, int interval,
+                                 bool repeat)
+{
+  vector<SizeSweep> sweeps;
+  for (auto conn: connections_) {
+    sweeps.push_back(SizeSweep(conn, min_size, max_size, factor));
+  }
+
+  HandleCntrlC();
+  while (!exiting_g && count > 0) {
+    for (auto& sweep: sweeps) {
+      sweep.RunRound();
     }
     sleep(interval);
     if (!repeat) {
       count -= 1;
     }
   }
-  if (boost::accumulators::count(time_acc) > 0) {
-    log_println("\ntime  min/avg/max = %.2f/%.2f/%.2f ms",
-                min(time_acc),
-                mean(time_acc),
-                max(time_acc));
-    log_println("speed min/avg/max = %.2f/%.2f/%.2f MB/s",
-                min(speed_acc),
-                mean(speed_acc),
-                max(speed_acc));
+  for (auto& sweep: sweeps) {
+    sweep.Dump();
+  }
+}
+
+void StatGenerator::DumpExactPercentiles() const
+{
+  static const double percents[] = {50, 90, 99, 99.9, 99.99, 100};
+  vector<double> p(percents, percents + sizeof(percents) / sizeof(percents[0]));
+  uint64_t samples = 0;
+  size_t bytes = 0;
+
+  for (auto& report: reports_) {
+    samples += report.get_samples().size();
+    bytes += report.get_samples().get_memory_bytes();
+  }
+  if (samples == 0) {
+    return;
+  }
+  log_println("\nexact latency of successful requests, %ld requests kept in %.1f MB",
+              samples, bytes / 1048576.0);
+  log_println("  %-10s %10s %10s %10s %10s %10s %10s", "msec", "p50", "p90", "p99",
+              "p99.9", "p99.99", "max");
+  for (int phase = 0; phase < SampleStore::PHASES; phase++) {
+    vector<uint32_t> usecs;
+    vector<uint32_t> values;
+    for (auto& report: reports_) {
+      report.get_samples().GetSuccessUsec((SampleStore::Phase)phase, &usecs);
+    }
+    SampleStore::Percentiles(&usecs, p, &values);
+    log_println("  %-10s %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f",
+                SampleStore::PhaseName((SampleStore::Phase)phase), values[0] / 1000.0,
+                values[1] / 1000.0, values[2] / 1000.0, values[3] / 1000.0,
+                values[4] / 1000.0, values[5] / 1000.0);
+  }
+}
+
+int StatGenerator::SaveSamples(const string& path) const
+{
+  std::ofstream os(path.c_str());
+  if (!os) {
+    log_error("failed to open '%s' for writing", path.c_str());
+    return RET_FAIL;
+  }
+  os << "# cloud-ping samples\n";
+  for (size_t i = 0; i < reports_.size(); i++) {
+    os << "# target " << i << " " << connections_[i]->get_url() << "\n";
+  }
+  os << "# start_usec\ttarget\tcode\toutcome\tbytes";
+  for (int phase = 0; phase < SampleStore::PHASES; phase++) {
+    os << "\t" << SampleStore::PhaseName((SampleStore::Phase)phase) << "_usec";
   }
+  os << "\n";
+  for (size_t i = 0; i < reports_.size(); i++) {
+    reports_[i].get_samples().Write(os, i);
+  }
+  if (!os) {
+    log_error("failed to write '%s'", path.c_str());
+    return RET_FAIL;
+  }
+  return RET_OK;
 }
 
 void StatGenerator::DumpStatistics(const Statistics &stat)
@@ -93,21 +635,48 @@ void StatGenerator::DumpStatistics(const Statistics &stat)
                 stat.get_url().c_str(),
                 total_time_msec,
                 actual_speed_in_mb_sec, max_speed_in_mb_sec);
+    if (stat.has_tls()) {
+      const TlsInfo &tls = stat.get_tls_info();
+      log_println("    tls=%.2f msec %s %s %s",
+                  tls.handshake_usec / 1000.0,
+                  tls.resumed ? "resumed" : "full",
+                  tls.protocol, tls.cipher);
+    }
+    if (stat.has_kernel_rx_time()) {
+      log_println("    rx kernel->wakeup=%.3f msec kernel->app=%.3f msec",
+                  Statistics::Msec(stat.GetKernelToWakeupTime()),
+                  Statistics::Msec(stat.GetKernelToAppTime()));
+    }
+    if (stat.get_stall_count() > 0) {
+      log_println("    stalls=%ld stall_time=%.2f msec max_gap=%.2f msec",
+                  stat.get_stall_count(),
+                  stat.get_stall_usec() / 1000.0,
+                  stat.get_chunk_gaps().max() / 1000.0);
+    }
   }
   else {
-    log_println("[%ld.%ld] %s code=%ld",
+    log_println("[%ld.%ld] %s code=%ld %s time=%.2f msec",
                 std::get<0>(start_time), std::get<1>(start_time),
-                stat.get_url().c_str(), stat.get_http_code());
+                stat.get_url().c_str(), stat.get_http_code(),
+                ReqOutcomeName(stat.get_outcome()), total_time_msec);
   }
 
 }
 
 
 Statistics::Statistics():
-  url_(""), first_data_(true), data_size_(0)
+  url_(""), cancel_(NULL), first_data_(true), data_size_(0), http_code_(0), outcome_(REQ_OK),
+  has_tls_(false),
+  has_tcp_info_(false), has_kernel_rx_time_(false),
+  stall_count_(0), stall_usec_(0)
 {
   memset(times_, 0, sizeof(times_));
   memset(flags_, 0, sizeof(flags_));
+  memset(&tls_info_, 0, sizeof(tls_info_));
+  memset(&tcp_info_, 0, sizeof(tcp_info_));
+  memset(&kernel_rx_time_, 0, sizeof(kernel_rx_time_));
+  memset(&wakeup_time_, 0, sizeof(wakeup_time_));
+  memset(ramp_bytes_, 0, sizeof(ramp_bytes_));
 }
 
 bool Statistics::RecordEventOnFirstTime(EventType event)
@@ -123,6 +692,12 @@ bool Statistics::RecordEventOnFirstTime(EventType event)
 void Statistics::RecordEvent(EventType event)
 {
   gettimeofday(&times_[event], NULL);
+  flags_[event] = true;
+}
+
+void Statistics::OnReqStart()
+{
+  RecordEventOnFirstTime(REQ_START);
 }
 
 void Statistics::OnReqSendHeaders()
@@ -139,33 +714,141 @@ void Statistics::OnReqRecvHeaders()
   }
 }
 
-void Statistics::OnComplete(unsigned long http_code)
+void Statistics::OnTlsHandshake(const TlsInfo &info)
+{
+  log_info("handshake_usec=%ld, resumed=%d, protocol=%s, cipher=%s",
+           info.handshake_usec, info.resumed, info.protocol, info.cipher);
+  tls_info_ = info;
+  has_tls_ = true;
+}
+
+void Statistics::OnTcpInfo(const TcpInfo &info)
+{
+  log_info("rtt=%u, rttvar=%u, cwnd=%u, retrans=%u, delivery_rate=%ld",
+           info.rtt_usec, info.rttvar_usec, info.snd_cwnd,
+           info.total_retrans, info.delivery_rate);
+  tcp_info_ = info;
+  has_tcp_info_ = true;
+}
+
+void Statistics::OnKernelRxTimestamp(const struct timeval &kernel_time,
+                                     const struct timeval &wakeup_time)
 {
-  log_info("http_code=%ld", http_code);
+  log_info("kernel_time=%ld.%06ld, wakeup_time=%ld.%06ld",
+           kernel_time.tv_sec, kernel_time.tv_usec,
+           wakeup_time.tv_sec, wakeup_time.tv_usec);
+  kernel_rx_time_ = kernel_time;
+  wakeup_time_ = wakeup_time;
+  has_kernel_rx_time_ = true;
+}
+
+void Statistics::OnComplete(unsigned long http_code, ReqOutcome outcome)
+{
+  log_info("http_code=%ld outcome=%s", http_code, ReqOutcomeName(outcome));
   http_code_ = http_code;
+  outcome_ = outcome;
+  // a request that failed or timed out ends now rather than at its last
+  // data, so it is counted at its cutoff
+  if (!flags_[DATA_RECV_START] ||
+      (outcome != REQ_OK && outcome != REQ_TRUNCATED)) {
+    RecordEvent(DATA_RECV_END);
+  }
+}
+
+bool Statistics::IsCancelled()
+{
+  return cancel_ != NULL && cancel_->load();
 }
 
 void Statistics::OnReqRecvData(size_t size)
 {
   log_info("size=%ld", size);
-  RecordEventOnFirstTime(DATA_RECV_START);
-  RecordEvent(DATA_RECV_END);
+  if (RecordEventOnFirstTime(DATA_RECV_START)) {
+    times_[DATA_RECV_END] = times_[DATA_RECV_START];
+    flags_[DATA_RECV_END] = true;
+  }
+  else {
+    struct timeval prev = times_[DATA_RECV_END];
+    RecordEvent(DATA_RECV_END);
+    uint64_t gap_usec = Usec(Diff(&prev, &times_[DATA_RECV_END]));
+    chunk_gaps_usec_.Record(gap_usec);
+    if (gap_usec >= stall_threshold_usec_) {
+      stall_count_++;
+      stall_usec_ += gap_usec;
+    }
+  }
+  if (ramp_bucket_usec_ > 0) {
+    uint64_t idx = Usec(GetTransferTime()) / ramp_bucket_usec_;
+    if (idx < RAMP_BUCKETS) {
+      ramp_bytes_[idx] += size;
+    }
+  }
   data_size_ += size;
 }
 
-inline tuple<uint64_t, uint64_t> Statistics::GetStartTime() const
+void Statistics::InheritStart(const Statistics &other)
 {
-  const struct timeval *t = &times_[HEADERS_SEND_START];
+  for (EventType event: {REQ_START, HEADERS_SEND_START}) {
+    times_[event] = other.times_[event];
+    flags_[event] = other.flags_[event];
+  }
+}
+
+// requests are timed from sending their headers, the ones that never got
+// that far from the start of the request
+const struct timeval *Statistics::StartTime() const
+{
+  return flags_[HEADERS_SEND_START] ? &times_[HEADERS_SEND_START] :
+    &times_[REQ_START];
+}
+
+tuple<uint64_t, uint64_t> Statistics::GetStartTime() const
+{
+  const struct timeval *t = StartTime();
   return std::make_tuple(t->tv_sec, t->tv_usec);
 }
 
 
-inline tuple<uint64_t, uint64_t> Statistics::GetTotalTime() const
+tuple<uint64_t, uint64_t> Statistics::GetTotalTime() const
 {
-  const struct timeval *t_start = &times_[HEADERS_SEND_START];
+  const struct timeval *t_start = StartTime();
   // const struct timeval *t_start = &times_[DATA_RECV_START];
   const struct timeval *t_end = &times_[DATA_RECV_END];
+  return Diff(t_start, t_end);
+}
+
+// zero for requests that received no data, their end is stamped at
+// completion without a data start
+tuple<uint64_t, uint64_t> Statistics::GetTransferTime() const
+{
+  return GetPhaseTime(DATA_RECV_START, DATA_RECV_END);
+}
+
+tuple<uint64_t, uint64_t> Statistics::GetPhaseTime(EventType from, EventType to) const
+{
+  if (!flags_[from] || !flags_[to]) {
+    return std::make_tuple(0, 0);
+  }
+  return Diff(&times_[from], &times_[to]);
+}
 
+tuple<uint64_t, uint64_t> Statistics::GetKernelToWakeupTime() const
+{
+  return Diff(&kernel_rx_time_, &wakeup_time_);
+}
+
+tuple<uint64_t, uint64_t> Statistics::GetKernelToAppTime() const
+{
+  return Diff(&kernel_rx_time_, &times_[HEADERS_RECV_START]);
+}
+
+/* static */
+tuple<uint64_t, uint64_t> Statistics::Diff(const struct timeval *t_start,
+                                           const struct timeval *t_end)
+{
+  if (timercmp(t_end, t_start, <)) {
+    return std::make_tuple(0, 0);
+  }
   uint64_t sec = t_end->tv_sec - t_start->tv_sec;
   uint64_t usec = t_end->tv_usec - t_start->tv_usec;
   if (t_end->tv_usec < t_start->tv_usec) {
@@ -181,6 +864,12 @@ double Statistics::Msec(const tuple<uint64_t, uint64_t>& t)
   return std::get<0>(t)*1000 + (std::get<1>(t) / 1000.0);
 }
 
+/* static */
+uint64_t Statistics::Usec(const tuple<uint64_t, uint64_t>& t)
+{
+  return std::get<0>(t)*1000000 + std::get<1>(t);
+}
+
 double Statistics::MBsec(const tuple<uint64_t, uint64_t>& t, size_t size)
 {
   double usec = std::get<0>(t)*1000000 + std::get<1>(t);
@@ -4,9 +4,22 @@
 #include <string>
 #include <vector>
 #include <tuple>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <sched.h>
 
 #include "cloud_conn.h"
 #include "http_req.h"
+#include "stat_report.h"
+#include "histogram.h"
+#include "live_stats.h"
+#include "shm_metrics.h"
+#include "metrics_server.h"
+#include "cpu_usage.h"
+#include "hedge.h"
+#include "placement.h"
+#include "heatmap.h"
 
 using std::string;
 using std::vector;
@@ -19,53 +32,205 @@ enum EventType {
   HEADERS_RECV_END,
   DATA_RECV_START,
   DATA_RECV_END,
+  REQ_START,
   MAX_EVENTS
 };
 class Statistics : public HttpReqEvents
 {
 public:
   Statistics();
+  virtual void OnReqStart();
   virtual void OnReqSendHeaders();
   virtual void OnReqRecvHeaders();
   virtual void OnReqRecvData(size_t size);
-  virtual void OnComplete(unsigned long http_code);
+  virtual void OnTlsHandshake(const TlsInfo &info);
+  virtual void OnTcpInfo(const TcpInfo &info);
+  virtual void OnKernelRxTimestamp(const struct timeval &kernel_time,
+                                   const struct timeval &wakeup_time);
+  virtual void OnComplete(unsigned long http_code, ReqOutcome outcome);
+  virtual bool IsCancelled();
 
   void set_url(const string& url) { url_ = url; }
+  void set_cancel(const std::atomic<bool> *cancel) { cancel_ = cancel; }
+  // times the request from when 'other' started, for a copy racing it
+  void InheritStart(const Statistics &other);
   const string& get_url() const { return url_; }
 
   unsigned long get_http_code() const { return http_code_;}
-  bool IsSuccess() const { return http_code_ >= 200 && http_code_ < 300; }
+  ReqOutcome get_outcome() const { return outcome_; }
+  // a response cut at the data limit is a success
+  bool IsSuccess() const {
+    return (outcome_ == REQ_OK || outcome_ == REQ_TRUNCATED) &&
+      http_code_ >= 200 && http_code_ < 300;
+  }
   size_t get_data_size() const { return data_size_; }
+  bool has_tls() const { return has_tls_; }
+  const TlsInfo& get_tls_info() const { return tls_info_; }
+  bool has_tcp_info() const { return has_tcp_info_; }
+  const TcpInfo& get_tcp_info() const { return tcp_info_; }
+  bool has_kernel_rx_time() const { return has_kernel_rx_time_; }
+  tuple<uint64_t, uint64_t> GetKernelToWakeupTime() const;
+  tuple<uint64_t, uint64_t> GetKernelToAppTime() const;
+  tuple<uint64_t, uint64_t> GetTransferTime() const;
+  // zero unless both events happened
+  tuple<uint64_t, uint64_t> GetPhaseTime(EventType from, EventType to) const;
+  const Histogram& get_chunk_gaps() const { return chunk_gaps_usec_; }
+  uint64_t get_stall_count() const { return stall_count_; }
+  uint64_t get_stall_usec() const { return stall_usec_; }
+  static void set_stall_threshold_usec(uint64_t usec) { stall_threshold_usec_ = usec; }
+  const uint64_t *get_ramp_bytes() const { return ramp_bytes_; }
+  static uint64_t get_ramp_bucket_usec() { return ramp_bucket_usec_; }
+  static void set_ramp_bucket_usec(uint64_t usec) { ramp_bucket_usec_ = usec; }
   tuple<uint64_t, uint64_t> GetStartTime() const;
   tuple<uint64_t, uint64_t> GetTotalTime() const;
+  static tuple<uint64_t, uint64_t> Diff(const struct timeval *t_start,
+                                        const struct timeval *t_end);
   static double Msec(const tuple<uint64_t, uint64_t>& t);
+  static uint64_t Usec(const tuple<uint64_t, uint64_t>& t);
   static double MBsec(const tuple<uint64_t, uint64_t>& t, size_t size);
 private:
   bool RecordEventOnFirstTime(EventType event);
   void RecordEvent(EventType event);
+  const struct timeval *StartTime() const;
 private:
   string url_;
+  const std::atomic<bool> *cancel_;
   struct timeval times_[MAX_EVENTS+1];
   bool flags_[MAX_EVENTS+1];
   bool first_data_;
   size_t data_size_;
   unsigned long http_code_;
+  ReqOutcome outcome_;
+  bool has_tls_;
+  TlsInfo tls_info_;
+  bool has_tcp_info_;
+  TcpInfo tcp_info_;
+  bool has_kernel_rx_time_;
+  struct timeval kernel_rx_time_;
+  struct timeval wakeup_time_;
+  Histogram chunk_gaps_usec_;
+  uint64_t stall_count_;
+  uint64_t stall_usec_;
+  static uint64_t stall_threshold_usec_;
+  // bytes received per time bucket since the first data byte, bytes past
+  // the last bucket are not profiled
+  uint64_t ramp_bytes_[RAMP_BUCKETS];
+  static uint64_t ramp_bucket_usec_;
+};
+
+struct Worker
+{
+  Worker(): id(0), ready(false), last_core(-1), core_changes(0) { CPU_ZERO(&cores); }
+  int id;
+  std::thread thread;
+  // one report per connection, merged into the generator when joined
+  vector<StatReport> reports;
+  // all connections' requests since the last interval report
+  std::unique_ptr<LiveStats> live;
+  // set once the worker thread, after pinning, allocated reports and live
+  // so first touch put them on its NUMA node
+  std::atomic<bool> ready;
+  // CPU of the worker thread over the trial, with --cpu-accounting
+  CpuCounters cpu;
+  // cores the thread was on after its requests
+  cpu_set_t cores;
+  int last_core;
+  uint64_t core_changes;
+};
+
+// CPU of the worker threads with the same id over all trials
+struct WorkerCpu
+{
+  WorkerCpu(): requests(0), bytes(0), pinned_core(-1), core_changes(0) {
+    CPU_ZERO(&cores);
+  }
+  CpuCounters cpu;
+  uint64_t requests;
+  uint64_t bytes;
+  int pinned_core;
+  cpu_set_t cores;
+  uint64_t core_changes;
 };
 
 class StatGenerator
 {
 public:
+  StatGenerator();
+  ~StatGenerator();
   void AddConnection(const string& url, const string& auth,
                      uint64_t range_start,
                      uint64_t range_end,
                      size_t len);
+  void SetReqOptions(const HttpReqOptions &options);
+  const HttpReqOptions& get_req_options() const { return req_options_; }
+  void SetRange(uint64_t range_start, uint64_t range_end);
+  void SetConcurrency(int concurrency) { concurrency_ = concurrency; }
+  int get_concurrency() const { return concurrency_; }
+  void SetQuiet(bool quiet) { quiet_ = quiet; }
+  void SetDetectWarmup(bool detect) { detect_warmup_ = detect; }
+  void SetPrecision(bool precision) { precision_ = precision; }
+  void SetReportInterval(uint64_t usec) { report_interval_usec_ = usec; }
+  int PublishShm(const string& name);
+  int StartMetricsServer(const string& addr, int port);
+  void SetCpuAccounting(bool enable) { cpu_accounting_ = enable; }
+  // pins worker i to the i-th core of the policy's order, see CpuPlacement
+  int SetPlacement(CpuPlacement::Policy policy, const string& cpus);
+  // latency of every 'window_usec' of the run, rendered and saved to path
+  // at the end
+  void SetHeatmap(const string& path, uint64_t window_usec);
+  // exact percentiles of the retained samples in the summary, and every
+  // request written to path if not empty
+  void SetExactPercentiles(const string& path);
+  // delay_usec 0 hedges at the running p95, an empty url hedges to the
+  // same target
+  int SetHedge(uint64_t delay_usec, const string& url, const string& auth,
+               uint64_t range_start, uint64_t range_end, size_t len);
   void Run(int count, int interval, bool repeat);
+  void RunTrial(int count, int interval, bool repeat);
+  void ResetReports();
+  StatReport GetTotalReport() const;
+  const vector<StatReport>& get_reports() const { return reports_; }
+  uint64_t get_elapsed_usec() const { return elapsed_usec_; }
+  static bool IsExiting();
+  // Ctrl-C sets IsExiting, a second one exits
+  static void HandleCntrlC();
+  void RunSizeSweep(uint64_t min_size, uint64_t max_size, double factor,
+                    int count, int interval, bool repeat);
   void DumpStatistics(const Statistics &stat);
+  void DumpSummary() const;
+  void DumpCpuUsage() const;
+  void DumpPlacement() const;
+  void DumpExactPercentiles() const;
+  int SaveSamples(const string& path) const;
 private:
-  void HandleCntrlC();
   void OnStop(int sig);
+  void RunWorker(Worker *worker, int interval, bool repeat);
+  void RunReporter(vector<Worker> *workers, const std::atomic<bool> *done);
+  void DrainWorkers(vector<Worker> *workers, const struct timeval &now,
+                    IntervalStats *interval);
+  void RunUntilPrecise(int count, int interval, bool repeat);
 private:
   vector<CloudConnection*> connections_;
+  vector<StatReport> reports_;
+  HttpReqOptions req_options_;
+  int concurrency_;
+  bool quiet_;
+  bool detect_warmup_;
+  bool precision_;
+  uint64_t report_interval_usec_;
+  ShmMetrics *shm_;
+  MetricsServer *metrics_;
+  bool cpu_accounting_;
+  vector<WorkerCpu> worker_cpu_;
+  CpuPlacement *placement_;
+  Heatmap *heatmap_;
+  string heatmap_path_;
+  bool exact_percentiles_;
+  string samples_path_;
+  Hedger *hedger_;
+  CloudConnection *hedge_conn_;
+  std::atomic<int> rounds_left_;
+  uint64_t elapsed_usec_;
 };
 
 #endif /* _STAT_GEN_H_ */
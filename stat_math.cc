@@ -0,0 +1,125 @@
+#include <math.h>
+#include <algorithm>
+#include <boost/math/distributions/normal.hpp>
+
+#include "stat_math.h"
+
+static const size_t MSER_BATCH = 5;
+
+size_t DetectWarmup(const vector<double> &series)
+{
+  vector<double> batches;
+  for (size_t i = 0; i + MSER_BATCH <= series.size(); i += MSER_BATCH) {
+    double sum = 0;
+    for (size_t j = 0; j < MSER_BATCH; j++) {
+      sum += series[i + j];
+    }
+    batches.push_back(sum / MSER_BATCH);
+  }
+  size_t n = batches.size();
+  if (n < 4) {
+    return 0;
+  }
+
+  // suffix sums give the mean and variance of batches[d..n) in O(1)
+  vector<double> sum(n + 1, 0);
+  vector<double> sum_sq(n + 1, 0);
+  for (size_t i = n; i > 0; i--) {
+    sum[i-1] = sum[i] + batches[i-1];
+    sum_sq[i-1] = sum_sq[i] + batches[i-1] * batches[i-1];
+  }
+
+  size_t best = 0;
+  double best_mser = -1;
+  for (size_t d = 0; d <= n / 2; d++) {
+    double m = n - d;
+    double mean = sum[d] / m;
+    double sse = sum_sq[d] - m * mean * mean;
+    double mser = sse / (m * m);
+    if (best_mser < 0 || mser < best_mser) {
+      best_mser = mser;
+      best = d;
+    }
+  }
+  return best * MSER_BATCH;
+}
+
+bool PercentileCI(vector<double> samples, double percent, double confidence,
+                  double *low, double *estimate, double *high)
+{
+  size_t n = samples.size();
+  if (n == 0) {
+    return false;
+  }
+
+  double p = percent / 100;
+  boost::math::normal normal;
+  double z = boost::math::quantile(normal, 1 - (1 - confidence) / 2);
+  double spread = z * sqrt(n * p * (1 - p));
+  double center = n * p;
+  if (center - spread < 1 || center + spread > n) {
+    // too few samples to bound the percentile on both sides
+    return false;
+  }
+
+  size_t low_rank = (size_t)floor(center - spread);
+  size_t high_rank = std::min((size_t)ceil(center + spread), n - 1);
+  size_t rank = std::min((size_t)center, n - 1);
+
+  std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+  *estimate = samples[rank];
+  std::nth_element(samples.begin(), samples.begin() + low_rank, samples.begin() + rank);
+  *low = samples[low_rank];
+  std::nth_element(samples.begin() + rank, samples.begin() + high_rank, samples.end());
+  *high = samples[high_rank];
+  return true;
+}
+
+double MannWhitneyGreater(const vector<double> &baseline,
+                          const vector<double> &current)
+{
+  double n1 = baseline.size();
+  double n2 = current.size();
+  if (n1 == 0 || n2 == 0) {
+    return 1;
+  }
+
+  // (value, is current) pairs ranked together, ties get the average rank
+  vector<std::pair<double, bool>> all;
+  for (auto v: baseline) {
+    all.push_back(std::make_pair(v, false));
+  }
+  for (auto v: current) {
+    all.push_back(std::make_pair(v, true));
+  }
+  std::sort(all.begin(), all.end());
+
+  double n = all.size();
+  double rank_sum = 0;
+  double ties = 0;
+  for (size_t i = 0; i < all.size();) {
+    size_t j = i;
+    while (j < all.size() && all[j].first == all[i].first) {
+      j++;
+    }
+    double rank = (i + 1 + j) / 2.0;
+    for (size_t k = i; k < j; k++) {
+      if (all[k].second) {
+        rank_sum += rank;
+      }
+    }
+    double t = j - i;
+    ties += t * t * t - t;
+    i = j;
+  }
+
+  double u = rank_sum - n2 * (n2 + 1) / 2;
+  double mean = n1 * n2 / 2;
+  double var = n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1)));
+  if (var <= 0) {
+    return 1;
+  }
+  double z = (u - mean - 0.5) / sqrt(var);
+  boost::math::normal normal;
+  return boost::math::cdf(boost::math::complement(normal, z));
+}
@@ -0,0 +1,24 @@
+#ifndef _STAT_MATH_H_
+#define _STAT_MATH_H_
+
+#include <vector>
+
+using std::vector;
+
+// Number of leading samples to drop as warm-up, chosen by MSER-5: the
+// truncation point minimizing the marginal standard error of the mean of
+// the remaining batch means. Never more than half of the series.
+size_t DetectWarmup(const vector<double> &series);
+
+// Distribution free confidence interval of a percentile from the order
+// statistics of the samples (normal approximation of the binomial ranks).
+bool PercentileCI(vector<double> samples, double percent, double confidence,
+                  double *low, double *estimate, double *high);
+
+// One sided Mann-Whitney U test (normal approximation with tie
+// correction): p-value of 'current' being stochastically greater than
+// 'baseline'.
+double MannWhitneyGreater(const vector<double> &baseline,
+                          const vector<double> &current);
+
+#endif /* _STAT_MATH_H_ */
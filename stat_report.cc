@@ -0,0 +1,532 @@
+#include <string.h>
+#include <algorithm>
+#include <boost/format.hpp>
+
+#include "stat_report.h"
+#include "stat_gen.h"
+#include "stat_math.h"
+#include "logging.h"
+
+static const double PRECISION_CONFIDENCE = 0.95;
+
+bool StatReport::retain_samples_ = false;
+double StatReport::precision_percent_ = 50;
+double StatReport::precision_width_ = 0;
+bool StatReport::precision_relative_ = false;
+
+StatReport::StatReport():
+  requests_(0), successes_(0), bytes_(0), stalled_requests_(0), stall_count_(0), stall_usec_(0),
+  transfer_usec_(0), warmup_samples_(0)
+{
+  memset(outcomes_, 0, sizeof(outcomes_));
+  memset(ramp_bytes_, 0, sizeof(ramp_bytes_));
+  memset(ramp_transfers_, 0, sizeof(ramp_transfers_));
+}
+
+void StatReport::Add(const Statistics &stat)
+{
+  if (url_.empty()) {
+    url_ = stat.get_url();
+  }
+  Sample sample;
+  SampleStore::FromStatistics(stat, &sample);
+  AddTotals(sample);
+  outcomes_[stat.get_outcome()]++;
+  if (retain_samples_) {
+    samples_.Add(sample);
+  }
+  if (stat.has_tls()) {
+    if (stat.get_tls_info().resumed) {
+      tls_resumed_usec_.Record(stat.get_tls_info().handshake_usec);
+    }
+    else {
+      tls_full_usec_.Record(stat.get_tls_info().handshake_usec);
+    }
+  }
+
+  if (stat.has_tcp_info()) {
+    const TcpInfo &tcp = stat.get_tcp_info();
+    tcp_rtt_usec_.Record(tcp.rtt_usec);
+    tcp_rttvar_usec_.Record(tcp.rttvar_usec);
+    tcp_cwnd_.Record(tcp.snd_cwnd);
+    tcp_retrans_.Record(tcp.total_retrans);
+    tcp_delivery_rate_.Record(tcp.delivery_rate);
+  }
+
+  if (stat.has_kernel_rx_time()) {
+    rx_kernel_to_wakeup_usec_.Record(Statistics::Usec(stat.GetKernelToWakeupTime()));
+    rx_kernel_to_app_usec_.Record(Statistics::Usec(stat.GetKernelToAppTime()));
+  }
+
+  chunk_gaps_usec_.Merge(stat.get_chunk_gaps());
+  if (stat.get_stall_count() > 0) {
+    stalled_requests_++;
+  }
+  stall_count_ += stat.get_stall_count();
+  stall_usec_ += stat.get_stall_usec();
+  transfer_usec_ += Statistics::Usec(stat.GetTransferTime());
+
+  if (Statistics::get_ramp_bucket_usec() > 0 && stat.get_data_size() > 0) {
+    uint64_t full_buckets = Statistics::Usec(stat.GetTransferTime()) /
+      Statistics::get_ramp_bucket_usec();
+    const uint64_t *bytes = stat.get_ramp_bytes();
+    for (uint64_t i = 0; i < full_buckets && i < RAMP_BUCKETS; i++) {
+      ramp_bytes_[i] += bytes[i];
+      ramp_transfers_[i]++;
+    }
+  }
+}
+
+void StatReport::AddTotals(const Sample &sample)
+{
+  uint64_t time_usec = sample.phase_usec[SampleStore::TOTAL];
+  requests_++;
+  if (sample.IsSuccess()) {
+    successes_++;
+  }
+  bytes_ += sample.bytes;
+
+  time_usec_.Record(time_usec);
+  if (time_usec > 0) {
+    speed_bps_.Record(sample.bytes * 1000000 / time_usec);
+  }
+}
+
+void StatReport::Merge(const StatReport &other)
+{
+  if (url_.empty()) {
+    url_ = other.url_;
+  }
+  requests_ += other.requests_;
+  successes_ += other.successes_;
+  bytes_ += other.bytes_;
+  for (int i = 0; i < REQ_OUTCOMES; i++) {
+    outcomes_[i] += other.outcomes_[i];
+  }
+  time_usec_.Merge(other.time_usec_);
+  speed_bps_.Merge(other.speed_bps_);
+  tls_full_usec_.Merge(other.tls_full_usec_);
+  tls_resumed_usec_.Merge(other.tls_resumed_usec_);
+  samples_.Append(other.samples_);
+  warmup_samples_ += other.warmup_samples_;
+  tcp_rtt_usec_.Merge(other.tcp_rtt_usec_);
+  tcp_rttvar_usec_.Merge(other.tcp_rttvar_usec_);
+  tcp_cwnd_.Merge(other.tcp_cwnd_);
+  tcp_retrans_.Merge(other.tcp_retrans_);
+  tcp_delivery_rate_.Merge(other.tcp_delivery_rate_);
+  rx_kernel_to_wakeup_usec_.Merge(other.rx_kernel_to_wakeup_usec_);
+  rx_kernel_to_app_usec_.Merge(other.rx_kernel_to_app_usec_);
+  chunk_gaps_usec_.Merge(other.chunk_gaps_usec_);
+  stalled_requests_ += other.stalled_requests_;
+  stall_count_ += other.stall_count_;
+  stall_usec_ += other.stall_usec_;
+  transfer_usec_ += other.transfer_usec_;
+  for (int i = 0; i < RAMP_BUCKETS; i++) {
+    ramp_bytes_[i] += other.ramp_bytes_[i];
+    ramp_transfers_[i] += other.ramp_transfers_[i];
+  }
+}
+
+static void DumpHistogram(const char *name, const Histogram &h,
+                          double scale, const char *unit)
+{
+  log_println("  %-14s p50/p90/p99/max = %.2f/%.2f/%.2f/%.2f %s",
+              name,
+              h.Percentile(50) / scale,
+              h.Percentile(90) / scale,
+              h.Percentile(99) / scale,
+              h.max() / scale,
+              unit);
+}
+
+void StatReport::TrimWarmup()
+{
+  // the workers' samples are merged in blocks, restore the request order
+  samples_.SortByStart();
+  vector<double> series;
+  Sample sample;
+  for (size_t i = 0; i < samples_.size(); i++) {
+    samples_.Get(i, &sample);
+    series.push_back(sample.phase_usec[SampleStore::TOTAL]);
+  }
+  size_t warmup = DetectWarmup(series);
+  if (warmup == 0) {
+    return;
+  }
+
+  // rebuild the request totals and outcomes without the warm-up samples,
+  // the tls, tcp, transfer and ramp sections are not kept per request and
+  // still include them, see UntrimmedNote
+  requests_ = 0;
+  successes_ = 0;
+  bytes_ = 0;
+  time_usec_.Reset();
+  speed_bps_.Reset();
+  memset(outcomes_, 0, sizeof(outcomes_));
+  samples_.DropFirst(warmup);
+  for (size_t i = 0; i < samples_.size(); i++) {
+    samples_.Get(i, &sample);
+    AddTotals(sample);
+    outcomes_[sample.outcome]++;
+  }
+  warmup_samples_ += warmup;
+}
+
+string StatReport::UntrimmedNote() const
+{
+  if (warmup_samples_ == 0) {
+    return "";
+  }
+  return str(boost::format(", including %ld warm-up requests") % warmup_samples_);
+}
+
+void StatReport::GetSuccessMsecs(vector<double> *msecs) const
+{
+  vector<uint32_t> usecs;
+  samples_.GetSuccessUsec(SampleStore::TOTAL, &usecs);
+  for (auto usec: usecs) {
+    msecs->push_back(usec / 1000.0);
+  }
+}
+
+bool StatReport::GetPercentileCI(double percent, double *low, double *estimate,
+                                 double *high) const
+{
+  vector<double> msecs;
+  GetSuccessMsecs(&msecs);
+  return PercentileCI(msecs, percent, PRECISION_CONFIDENCE, low, estimate, high);
+}
+
+/* static */
+void StatReport::SetPrecision(double percent, double width, bool relative)
+{
+  precision_percent_ = percent;
+  precision_width_ = width;
+  precision_relative_ = relative;
+}
+
+bool StatReport::IsPrecise() const
+{
+  double low;
+  double estimate;
+  double high;
+  if (!GetPercentileCI(precision_percent_, &low, &estimate, &high)) {
+    return false;
+  }
+  double width = precision_relative_ ? estimate * precision_width_ / 100 :
+    precision_width_;
+  return high - low <= width;
+}
+
+void StatReport::DumpPrecision() const
+{
+  if (!retain_samples_) {
+    return;
+  }
+  log_println("\nlatency %s (%ld samples, %ld warm-up samples excluded)",
+              url_.c_str(), samples_.size(), warmup_samples_);
+  double low;
+  double estimate;
+  double high;
+  if (!GetPercentileCI(precision_percent_, &low, &estimate, &high)) {
+    log_println("  too few samples for a confidence interval of p%g",
+                precision_percent_);
+    return;
+  }
+  log_println("  p%g %.2f ms, %g%% CI [%.2f, %.2f] width %.2f ms",
+              precision_percent_, estimate, PRECISION_CONFIDENCE * 100,
+              low, high, high - low);
+}
+
+const StatReport::NamedHistogram StatReport::kNamedHistograms[] = {
+  {"time_usec", &StatReport::time_usec_},
+  {"speed_bps", &StatReport::speed_bps_},
+  {"tls_full_usec", &StatReport::tls_full_usec_},
+  {"tls_resumed_usec", &StatReport::tls_resumed_usec_},
+  {"tcp_rtt_usec", &StatReport::tcp_rtt_usec_},
+  {"tcp_rttvar_usec", &StatReport::tcp_rttvar_usec_},
+  {"tcp_cwnd", &StatReport::tcp_cwnd_},
+  {"tcp_retrans", &StatReport::tcp_retrans_},
+  {"tcp_delivery_rate", &StatReport::tcp_delivery_rate_},
+  {"rx_kernel_to_wakeup_usec", &StatReport::rx_kernel_to_wakeup_usec_},
+  {"rx_kernel_to_app_usec", &StatReport::rx_kernel_to_app_usec_},
+  {"chunk_gaps_usec", &StatReport::chunk_gaps_usec_},
+};
+
+void StatReport::Save(std::ostream &os) const
+{
+  os << "target " << url_ << "\n";
+  os << "counters " << requests_ << " " << successes_ << " " << bytes_ << "\n";
+  os << "outcomes " << REQ_OUTCOMES;
+  for (int i = 0; i < REQ_OUTCOMES; i++) {
+    os << " " << outcomes_[i];
+  }
+  os << "\n";
+  os << "stalls " << stalled_requests_ << " " << stall_count_ << " "
+     << stall_usec_ << " " << transfer_usec_ << "\n";
+  // empty histograms are left out, they load as empty
+  for (auto& entry: kNamedHistograms) {
+    const Histogram &h = this->*entry.histogram;
+    if (h.count() > 0) {
+      os << "histogram " << entry.name << " ";
+      h.Save(os);
+      os << "\n";
+    }
+  }
+  int ramp_buckets = 0;
+  while (ramp_buckets < RAMP_BUCKETS && ramp_transfers_[ramp_buckets] > 0) {
+    ramp_buckets++;
+  }
+  if (ramp_buckets > 0) {
+    os << "ramp " << Statistics::get_ramp_bucket_usec() << " " << ramp_buckets;
+    for (int i = 0; i < ramp_buckets; i++) {
+      os << " " << ramp_bytes_[i] << " " << ramp_transfers_[i];
+    }
+    os << "\n";
+  }
+  os << "request_samples " << samples_.size() << " " << warmup_samples_;
+  Sample sample;
+  for (size_t i = 0; i < samples_.size(); i++) {
+    samples_.Get(i, &sample);
+    os << " " << sample.start_usec << " " << sample.bytes;
+    for (int phase = 0; phase < SampleStore::PHASES; phase++) {
+      os << " " << sample.phase_usec[phase];
+    }
+    os << " " << sample.code << " " << sample.outcome;
+  }
+  os << "\nend\n";
+}
+
+bool StatReport::Load(std::istream &is)
+{
+  string key;
+  if (!(is >> key) || key != "target" || !(is >> url_)) {
+    return false;
+  }
+  while (is >> key) {
+    if (key == "end") {
+      return true;
+    }
+    else if (key == "counters") {
+      is >> requests_ >> successes_ >> bytes_;
+    }
+    else if (key == "outcomes") {
+      // outcomes added later than the file are left at 0
+      int count;
+      is >> count;
+      for (int i = 0; i < count; i++) {
+        uint64_t n;
+        is >> n;
+        if (i < REQ_OUTCOMES) {
+          outcomes_[i] = n;
+        }
+      }
+    }
+    else if (key == "stalls") {
+      is >> stalled_requests_ >> stall_count_ >> stall_usec_ >> transfer_usec_;
+    }
+    else if (key == "histogram") {
+      string name;
+      Histogram *h = NULL;
+      is >> name;
+      for (auto& entry: kNamedHistograms) {
+        if (name == entry.name) {
+          h = &(this->*entry.histogram);
+        }
+      }
+      if (h == NULL) {
+        log_error("unknown histogram '%s'", name.c_str());
+        return false;
+      }
+      h->Load(is);
+    }
+    // version 1 files name the two histograms they have directly
+    else if (key == "time_usec") {
+      time_usec_.Load(is);
+    }
+    else if (key == "speed_bps") {
+      speed_bps_.Load(is);
+    }
+    else if (key == "ramp") {
+      uint64_t bucket_usec;
+      int ramp_buckets;
+      is >> bucket_usec >> ramp_buckets;
+      if (ramp_buckets > RAMP_BUCKETS) {
+        return false;
+      }
+      for (int i = 0; i < ramp_buckets; i++) {
+        is >> ramp_bytes_[i] >> ramp_transfers_[i];
+      }
+      if (Statistics::get_ramp_bucket_usec() == 0) {
+        Statistics::set_ramp_bucket_usec(bucket_usec);
+      }
+      else if (Statistics::get_ramp_bucket_usec() != bucket_usec) {
+        log_error("ramp bucket %ld usec does not match %ld usec",
+                  bucket_usec, Statistics::get_ramp_bucket_usec());
+        return false;
+      }
+    }
+    else if (key == "request_samples") {
+      size_t count;
+      Sample sample;
+      is >> count >> warmup_samples_;
+      for (size_t i = 0; i < count && is; i++) {
+        is >> sample.start_usec >> sample.bytes;
+        for (int phase = 0; phase < SampleStore::PHASES; phase++) {
+          is >> sample.phase_usec[phase];
+        }
+        is >> sample.code >> sample.outcome;
+        samples_.Add(sample);
+      }
+    }
+    // up to version 3 only the total time and success were kept
+    else if (key == "samples") {
+      size_t count;
+      bool success;
+      Sample sample;
+      memset(&sample, 0, sizeof(sample));
+      is >> count >> warmup_samples_;
+      for (size_t i = 0; i < count && is; i++) {
+        is >> sample.start_usec >> sample.bytes >> sample.phase_usec[SampleStore::TOTAL]
+           >> success;
+        sample.code = success ? 200 : 0;
+        sample.outcome = success ? REQ_OK : REQ_OTHER_ERROR;
+        samples_.Add(sample);
+      }
+    }
+    else {
+      log_error("unknown stats key '%s'", key.c_str());
+      return false;
+    }
+    if (!is) {
+      return false;
+    }
+  }
+  return false;
+}
+
+void StatReport::DumpTotals() const
+{
+  if (time_usec_.count() > 0) {
+    log_println("\ntime  min/avg/max = %.2f/%.2f/%.2f ms",
+                time_usec_.min() / 1000.0,
+                time_usec_.mean() / 1000.0,
+                time_usec_.max() / 1000.0);
+    log_println("time  p50/p90/p99 = %.2f/%.2f/%.2f ms",
+                time_usec_.Percentile(50) / 1000.0,
+                time_usec_.Percentile(90) / 1000.0,
+                time_usec_.Percentile(99) / 1000.0);
+    log_println("speed min/avg/max = %.2f/%.2f/%.2f MB/s",
+                speed_bps_.min() / 1048576.0,
+                speed_bps_.mean() / 1048576.0,
+                speed_bps_.max() / 1048576.0);
+  }
+  if (tls_full_usec_.count() > 0) {
+    log_println("tls full    min/avg/max = %.2f/%.2f/%.2f ms (%ld handshakes%s)",
+                tls_full_usec_.min() / 1000.0,
+                tls_full_usec_.mean() / 1000.0,
+                tls_full_usec_.max() / 1000.0,
+                tls_full_usec_.count(), UntrimmedNote().c_str());
+  }
+  if (tls_resumed_usec_.count() > 0) {
+    log_println("tls resumed min/avg/max = %.2f/%.2f/%.2f ms (%ld handshakes%s)",
+                tls_resumed_usec_.min() / 1000.0,
+                tls_resumed_usec_.mean() / 1000.0,
+                tls_resumed_usec_.max() / 1000.0,
+                tls_resumed_usec_.count(), UntrimmedNote().c_str());
+  }
+}
+
+void StatReport::DumpOutcomes() const
+{
+  string line;
+  for (int i = REQ_OK + 1; i < REQ_OUTCOMES; i++) {
+    if (outcomes_[i] > 0) {
+      line += str(boost::format("%s%s %d") % (line.empty() ? "" : ", ") %
+                  ReqOutcomeName(i) % outcomes_[i]);
+    }
+  }
+  if (!line.empty()) {
+    log_println("outcomes %s: ok %ld, %s", url_.c_str(), outcomes_[REQ_OK],
+                line.c_str());
+  }
+}
+
+void StatReport::Dump() const
+{
+  DumpOutcomes();
+  DumpPrecision();
+  if (tcp_rtt_usec_.count() > 0) {
+    log_println("\ntcp %s (%ld requests%s)", url_.c_str(), tcp_rtt_usec_.count(),
+                UntrimmedNote().c_str());
+    DumpHistogram("rtt", tcp_rtt_usec_, 1000.0, "ms");
+    DumpHistogram("rttvar", tcp_rttvar_usec_, 1000.0, "ms");
+    DumpHistogram("cwnd", tcp_cwnd_, 1, "segments");
+    DumpHistogram("retransmits", tcp_retrans_, 1, "segments");
+    DumpHistogram("delivery rate", tcp_delivery_rate_, 1048576.0, "MB/s");
+  }
+  if (rx_kernel_to_app_usec_.count() > 0) {
+    uint64_t responses = requests_ + warmup_samples_;
+    log_println("\nrx timestamps %s (%ld of %ld responses%s)", url_.c_str(),
+                rx_kernel_to_app_usec_.count(), responses, UntrimmedNote().c_str());
+    if (rx_kernel_to_app_usec_.count() < responses) {
+      log_println("  only the first response of a connection is timestamped");
+    }
+    DumpHistogram("kernel->wakeup", rx_kernel_to_wakeup_usec_, 1000.0, "ms");
+    DumpHistogram("kernel->app", rx_kernel_to_app_usec_, 1000.0, "ms");
+  }
+  if (chunk_gaps_usec_.count() > 0) {
+    log_println("\ntransfer %s (%ld chunk gaps%s)", url_.c_str(),
+                chunk_gaps_usec_.count(), UntrimmedNote().c_str());
+    DumpHistogram("chunk gap", chunk_gaps_usec_, 1000.0, "ms");
+    log_println("  stalls %ld in %ld/%ld requests, stall time %.2f ms = %.2f%% of transfer time",
+                stall_count_, stalled_requests_, requests_ + warmup_samples_,
+                stall_usec_ / 1000.0,
+                transfer_usec_ > 0 ? 100.0 * stall_usec_ / transfer_usec_ : 0.0);
+  }
+  DumpRampProfile();
+}
+
+void StatReport::DumpRampProfile() const
+{
+  uint64_t bucket_usec = Statistics::get_ramp_bucket_usec();
+  double rates[RAMP_BUCKETS];
+  int buckets = 0;
+  double peak = 0;
+  int peak_idx = 0;
+
+  if (bucket_usec == 0) {
+    return;
+  }
+  for (; buckets < RAMP_BUCKETS && ramp_transfers_[buckets] > 0; buckets++) {
+    // average per transfer rate over the bucket
+    rates[buckets] = (double)ramp_bytes_[buckets] / 1048576 /
+      ramp_transfers_[buckets] / (bucket_usec / 1000000.0);
+    if (rates[buckets] > peak) {
+      peak = rates[buckets];
+      peak_idx = buckets;
+    }
+  }
+  if (buckets == 0) {
+    return;
+  }
+
+  log_println("\nramp %s (%ld transfers, %.2f ms buckets%s)", url_.c_str(),
+              ramp_transfers_[0], bucket_usec / 1000.0, UntrimmedNote().c_str());
+  log_println("  peak %.2f MB/s at +%.2f ms", peak,
+              (peak_idx + 1) * bucket_usec / 1000.0);
+  static const int percents[] = {50, 75, 90};
+  for (auto percent: percents) {
+    for (int i = 0; i <= peak_idx; i++) {
+      if (rates[i] >= peak * percent / 100) {
+        log_println("  %d%% of peak at +%.2f ms", percent,
+                    (i + 1) * bucket_usec / 1000.0);
+        break;
+      }
+    }
+  }
+  for (int i = 0; i < buckets; i++) {
+    log_println("  +%-10.2f %10.2f MB/s (%ld transfers)",
+                (i + 1) * bucket_usec / 1000.0, rates[i], ramp_transfers_[i]);
+  }
+}
@@ -0,0 +1,111 @@
+#ifndef _STAT_REPORT_H_
+#define _STAT_REPORT_H_
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "histogram.h"
+#include "http_req.h"
+#include "sample_store.h"
+
+using std::string;
+using std::vector;
+
+static const int RAMP_BUCKETS = 256;
+
+class Statistics;
+
+class StatReport
+{
+public:
+  StatReport();
+  void Add(const Statistics &stat);
+  void Merge(const StatReport &other);
+  void Dump() const;
+  void DumpTotals() const;
+  void DumpRampProfile() const;
+  void DumpPrecision() const;
+  void DumpOutcomes() const;
+
+  // per request samples kept for warm-up detection and confidence intervals
+  static void set_retain_samples(bool retain) { retain_samples_ = retain; }
+  static bool get_retain_samples() { return retain_samples_; }
+  void TrimWarmup();
+  bool GetPercentileCI(double percent, double *low, double *estimate,
+                       double *high) const;
+  static void SetPrecision(double percent, double width, bool relative);
+  bool IsPrecise() const;
+  void GetSuccessMsecs(vector<double> *msecs) const;
+
+  // see StatFile for the format
+  void Save(std::ostream &os) const;
+  bool Load(std::istream &is);
+
+  const string& get_url() const { return url_; }
+  uint64_t get_requests() const { return requests_; }
+  uint64_t get_successes() const { return successes_; }
+  uint64_t get_bytes() const { return bytes_; }
+  const Histogram& get_time_usec() const { return time_usec_; }
+  const Histogram& get_speed_bps() const { return speed_bps_; }
+  const SampleStore& get_samples() const { return samples_; }
+private:
+  typedef SampleStore::Sample Sample;
+  void AddTotals(const Sample &sample);
+
+  // histograms by their name in saved reports
+  struct NamedHistogram {
+    const char *name;
+    Histogram StatReport::*histogram;
+  };
+  static const NamedHistogram kNamedHistograms[];
+
+  // the sections TrimWarmup cannot rebuild say so
+  string UntrimmedNote() const;
+
+  string url_;
+  uint64_t requests_;
+  uint64_t successes_;
+  uint64_t bytes_;
+  // requests by how they ended, see ReqOutcome
+  uint64_t outcomes_[REQ_OUTCOMES];
+
+  // request time and speed, tls handshake time
+  Histogram time_usec_;
+  Histogram speed_bps_;
+  Histogram tls_full_usec_;
+  Histogram tls_resumed_usec_;
+
+  // TCP_INFO of the connection at the end of each request
+  Histogram tcp_rtt_usec_;
+  Histogram tcp_rttvar_usec_;
+  Histogram tcp_cwnd_;
+  Histogram tcp_retrans_;
+  Histogram tcp_delivery_rate_;
+
+  // delay between the kernel receiving the first response bytes and the
+  // client waking up / the curl callback seeing them
+  Histogram rx_kernel_to_wakeup_usec_;
+  Histogram rx_kernel_to_app_usec_;
+
+  // gaps between consecutive data chunks and the ones counted as stalls
+  Histogram chunk_gaps_usec_;
+  uint64_t stalled_requests_;
+  uint64_t stall_count_;
+  uint64_t stall_usec_;
+  uint64_t transfer_usec_;
+
+  // bytes and number of transfers still running per ramp bucket, only
+  // buckets a transfer fully covered are counted
+  uint64_t ramp_bytes_[RAMP_BUCKETS];
+  uint64_t ramp_transfers_[RAMP_BUCKETS];
+
+  SampleStore samples_;
+  size_t warmup_samples_;
+  static bool retain_samples_;
+  static double precision_percent_;
+  static double precision_width_;
+  static bool precision_relative_;
+};
+
+#endif /* _STAT_REPORT_H_ */